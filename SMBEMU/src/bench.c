@@ -0,0 +1,292 @@
+#include "bench.h"
+
+#ifdef NES_BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nes_cpu.h"
+#include "nes_mem.h"
+#include "nes_ppu.h"
+#include "rom.h"
+
+#define BENCH_CODE 0x0300
+#define BENCH_DATA 0x0400
+
+typedef enum {
+    BENCH_STEP,
+    BENCH_READ,
+    BENCH_WRITE,
+    BENCH_CALL
+} bench_kind_t;
+
+typedef struct {
+    const char *name;
+    uint8_t kind;
+    uint16_t addr;
+    uint8_t code[3];
+    void (*call)(nes_t *nes);
+    uint16_t iterations;
+} bench_case_t;
+
+static nes_ppu_frame_t fixture;
+static uint8_t fixture_chr[NES_CHR_SIZE];
+static uint8_t fixture_buffer[320 * NES_SCREEN_HEIGHT];
+
+static void call_oam_dma(nes_t *nes) {
+    nes_cpu_write(nes, 0x4014, BENCH_DATA >> 8);
+}
+
+static void call_vram_write(nes_t *nes) {
+    nes->ppu.vram_addr = 0x2000;
+    for (int i = 0; i < 32; i++) {
+        nes_cpu_write(nes, 0x2007, (uint8_t)i);
+    }
+}
+
+static void call_vram_read(nes_t *nes) {
+    nes->ppu.vram_addr = 0x2000;
+    for (int i = 0; i < 32; i++) {
+        nes_cpu_read(nes, 0x2007);
+    }
+}
+
+static void call_background(nes_t *nes) {
+    (void)nes;
+    nes_ppu_draw_background(&fixture, fixture_chr, fixture_buffer);
+}
+
+static void call_sprites(nes_t *nes) {
+    (void)nes;
+    nes_ppu_draw_sprites(&fixture, fixture_chr, fixture_buffer);
+}
+
+static void call_tile_row(nes_t *nes) {
+    (void)nes;
+    NES_PPU_TILE_ROW(fixture_buffer, 0x5A, 0x3C, fixture.palette);
+}
+
+static void call_sprite_row(nes_t *nes) {
+    (void)nes;
+    NES_PPU_SPRITE_ROW(fixture_buffer, 0x5A, 0x3C, fixture.palette);
+}
+
+/* Loads SMBROM again into the banks the running instance already uses,
+ * raw or compressed, whichever it holds; the contents come out the same.
+ * A run with the raw AppVar saved as SMBBASE is the baseline for the
+ * compressed one. */
+static void call_rom_load(nes_t *nes) {
+    nes_rom_t rom;
+    const char *error;
+    (void)nes;
+    rom_load_smb(&rom, &error);
+}
+
+/* Operands point at zero page $10/$11, which holds BENCH_DATA; X and Y are 1.
+ * The "x32" cases do 32 accesses per iteration. */
+static const bench_case_t cases[] = {
+    { "cpu.nop", BENCH_STEP, 0, { 0xEA, 0, 0 }, NULL, 4000 },
+    { "cpu.lda_imm", BENCH_STEP, 0, { 0xA9, 0x01, 0 }, NULL, 4000 },
+    { "cpu.lda_zp", BENCH_STEP, 0, { 0xA5, 0x10, 0 }, NULL, 4000 },
+    { "cpu.lda_zpx", BENCH_STEP, 0, { 0xB5, 0x0F, 0 }, NULL, 4000 },
+    { "cpu.lda_abs", BENCH_STEP, 0, { 0xAD, 0x00, 0x04 }, NULL, 4000 },
+    { "cpu.lda_abx", BENCH_STEP, 0, { 0xBD, 0x00, 0x04 }, NULL, 4000 },
+    { "cpu.lda_aby", BENCH_STEP, 0, { 0xB9, 0x00, 0x04 }, NULL, 4000 },
+    { "cpu.lda_izx", BENCH_STEP, 0, { 0xA1, 0x0F, 0 }, NULL, 4000 },
+    { "cpu.lda_izy", BENCH_STEP, 0, { 0xB1, 0x10, 0 }, NULL, 4000 },
+    { "cpu.lda_prg", BENCH_STEP, 0, { 0xAD, 0x00, 0x80 }, NULL, 4000 },
+    { "cpu.sta_abs", BENCH_STEP, 0, { 0x8D, 0x00, 0x04 }, NULL, 4000 },
+    { "cpu.adc_zp", BENCH_STEP, 0, { 0x65, 0x10, 0 }, NULL, 4000 },
+    { "cpu.cmp_imm", BENCH_STEP, 0, { 0xC9, 0x01, 0 }, NULL, 4000 },
+    { "cpu.inc_zp", BENCH_STEP, 0, { 0xE6, 0x20, 0 }, NULL, 4000 },
+    { "cpu.asl_abx", BENCH_STEP, 0, { 0x1E, 0x00, 0x04 }, NULL, 4000 },
+    { "cpu.bne_taken", BENCH_STEP, 0, { 0xD0, 0x00, 0 }, NULL, 4000 },
+    { "cpu.jsr", BENCH_STEP, 0, { 0x20, 0x00, 0x03 }, NULL, 4000 },
+    { "cpu.jmp_ind", BENCH_STEP, 0, { 0x6C, 0x10, 0x00 }, NULL, 4000 },
+    { "bus.read_ram", BENCH_READ, 0x0010, { 0, 0, 0 }, NULL, 8000 },
+    { "bus.read_ppu", BENCH_READ, 0x2002, { 0, 0, 0 }, NULL, 8000 },
+    { "bus.read_4016", BENCH_READ, 0x4016, { 0, 0, 0 }, NULL, 8000 },
+    { "bus.read_prg", BENCH_READ, 0x8000, { 0, 0, 0 }, NULL, 8000 },
+    { "bus.write_ram", BENCH_WRITE, 0x0020, { 0, 0, 0 }, NULL, 8000 },
+    { "bus.write_ppu", BENCH_WRITE, 0x2001, { 0, 0, 0 }, NULL, 8000 },
+    { "bus.write_4016", BENCH_WRITE, 0x4016, { 0, 0, 0 }, NULL, 8000 },
+    { "ppu.vram_write_x32", BENCH_CALL, 0, { 0, 0, 0 }, call_vram_write, 200 },
+    { "ppu.vram_read_x32", BENCH_CALL, 0, { 0, 0, 0 }, call_vram_read, 200 },
+    { "ppu.oam_dma", BENCH_CALL, 0, { 0, 0, 0 }, call_oam_dma, 200 },
+    { "ppu.background", BENCH_CALL, 0, { 0, 0, 0 }, call_background, 4 },
+    { "ppu.sprites", BENCH_CALL, 0, { 0, 0, 0 }, call_sprites, 20 },
+    { "ppu.tile_row", BENCH_CALL, 0, { 0, 0, 0 }, call_tile_row, 4000 },
+    { "ppu.sprite_row", BENCH_CALL, 0, { 0, 0, 0 }, call_sprite_row, 4000 },
+    { "rom.load", BENCH_CALL, 0, { 0, 0, 0 }, call_rom_load, 4 }
+};
+
+#define BENCH_CASES (sizeof(cases) / sizeof(cases[0]))
+
+/* A busy nametable with vertical mirroring, every palette entry, and 64
+ * sprites on an 8x8 grid. */
+static void init_fixture(void) {
+    memset(&fixture, 0, sizeof(fixture));
+    fixture.ctrl = 0x10;
+    fixture.scroll_x = 3;
+    for (int i = 0; i < NES_NAMETABLE_SIZE; i++) {
+        fixture.nametable[i] = (uint8_t)(i * 7);
+    }
+    for (int i = 0; i < 4; i++) {
+        fixture.nametable_page[i] = (uint16_t)((i & 1) * NES_NAMETABLE_PAGE);
+    }
+    for (int i = 0; i < NES_PALETTE_SIZE; i++) {
+        fixture.palette[i] = (uint8_t)(i * 3 & 0x3F);
+    }
+    for (int i = 0; i < 64; i++) {
+        fixture.oam[i * 4] = (uint8_t)(16 + (i / 8) * 24);
+        fixture.oam[i * 4 + 1] = (uint8_t)i;
+        fixture.oam[i * 4 + 2] = (uint8_t)(i & 0xC3);
+        fixture.oam[i * 4 + 3] = (uint8_t)(16 + (i % 8) * 28);
+    }
+    for (int i = 0; i < NES_CHR_SIZE; i++) {
+        fixture_chr[i] = (uint8_t)(i * 13 + (i >> 4));
+    }
+}
+
+static void prepare(nes_t *nes, const bench_case_t *bench) {
+    nes_cpu_t *cpu = &nes->cpu;
+    cpu->x = 1;
+    cpu->y = 1;
+    cpu->p = FLAG_U | FLAG_I;
+    cpu->nmi_pending = false;
+    nes->ram[0x10] = BENCH_DATA & 0xFF;
+    nes->ram[0x11] = BENCH_DATA >> 8;
+    nes->ppu.ctrl = 0;
+    memcpy(&nes->ram[BENCH_CODE], bench->code, sizeof(bench->code));
+}
+
+static clock_t measure(nes_t *nes, const bench_case_t *bench) {
+    nes_cpu_t *cpu = &nes->cpu;
+    clock_t start = clock();
+    switch (bench->kind) {
+    case BENCH_STEP:
+        for (uint16_t i = 0; i < bench->iterations; i++) {
+            cpu->pc = BENCH_CODE;
+            cpu->sp = 0xFD;
+            nes_cpu_step(nes);
+        }
+        break;
+    case BENCH_READ:
+        for (uint16_t i = 0; i < bench->iterations; i++) {
+            nes_cpu_read(nes, bench->addr);
+        }
+        break;
+    case BENCH_WRITE:
+        for (uint16_t i = 0; i < bench->iterations; i++) {
+            nes_cpu_write(nes, bench->addr, (uint8_t)i);
+        }
+        break;
+    default:
+        for (uint16_t i = 0; i < bench->iterations; i++) {
+            bench->call(nes);
+        }
+        break;
+    }
+    return clock() - start;
+}
+
+/* Runs the selected pattern-row kernels against the C reference for every
+ * pair of planes and counts the rows that differ. */
+static uint32_t check_kernels(void) {
+    static const uint8_t colors[4] = { 0x0F, 0x16, 0x27, 0x30 };
+    uint8_t expected[8];
+    uint8_t actual[8];
+    uint32_t mismatches = 0;
+    for (uint16_t planes = 0; ; planes++) {
+        uint8_t plane0 = planes & 0xFF;
+        uint8_t plane1 = planes >> 8;
+        nes_ppu_tile_row(expected, plane0, plane1, colors);
+        NES_PPU_TILE_ROW(actual, plane0, plane1, colors);
+        if (memcmp(expected, actual, sizeof(actual)) != 0) {
+            mismatches++;
+        }
+        memset(expected, 0xEE, sizeof(expected));
+        memset(actual, 0xEE, sizeof(actual));
+        nes_ppu_sprite_row(expected, plane0, plane1, colors);
+        NES_PPU_SPRITE_ROW(actual, plane0, plane1, colors);
+        if (memcmp(expected, actual, sizeof(actual)) != 0) {
+            mismatches++;
+        }
+        if (planes == 0xFFFF) {
+            break;
+        }
+    }
+    return mismatches;
+}
+
+/* Emits one JSON object, one case per line in a fixed order. nes is left
+ * in an undefined state. */
+void bench_run(nes_t *nes, nes_report_fn emit, void *ctx) {
+    char line[96];
+    init_fixture();
+    emit(ctx, "{");
+    snprintf(line, sizeof(line), "  \"clocks_per_sec\": %lu,", (unsigned long)CLOCKS_PER_SEC);
+    emit(ctx, line);
+    snprintf(line, sizeof(line), "  \"kernel_mismatches\": %lu,", (unsigned long)check_kernels());
+    emit(ctx, line);
+    emit(ctx, "  \"results\": {");
+    for (size_t i = 0; i < BENCH_CASES; i++) {
+        const bench_case_t *bench = &cases[i];
+        prepare(nes, bench);
+        clock_t ticks = measure(nes, bench);
+        uint64_t ns = (uint64_t)ticks * 1000000000ull / ((uint64_t)CLOCKS_PER_SEC * bench->iterations);
+        snprintf(line, sizeof(line), "    \"%s\": {\"iterations\": %u, \"ticks\": %lu, \"ns_per_op\": %lu}%s",
+                 bench->name, (unsigned int)bench->iterations, (unsigned long)ticks,
+                 (unsigned long)ns, i + 1 < BENCH_CASES ? "," : "");
+        emit(ctx, line);
+    }
+    emit(ctx, "  }");
+    emit(ctx, "}");
+}
+
+static const char *find(const char *text, size_t size, const char *needle) {
+    size_t len = strlen(needle);
+    for (size_t i = 0; i + len <= size; i++) {
+        if (memcmp(text + i, needle, len) == 0) {
+            return text + i;
+        }
+    }
+    return NULL;
+}
+
+static bool lookup(const char *text, size_t size, const char *name, unsigned long *ns) {
+    char key[48];
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    const char *entry = find(text, size, key);
+    if (!entry) {
+        return false;
+    }
+    size_t rest = size - (size_t)(entry - text);
+    const char *value = find(entry, rest, "\"ns_per_op\":");
+    if (!value) {
+        return false;
+    }
+    *ns = strtoul(value + 12, NULL, 10);
+    return true;
+}
+
+/* Emits "name baseline current change%" for every case found in both. */
+void bench_compare(const char *baseline, size_t baseline_size, const char *current,
+                   size_t current_size, nes_report_fn emit, void *ctx) {
+    char line[96];
+    emit(ctx, "# case baseline_ns current_ns change_pct");
+    for (size_t i = 0; i < BENCH_CASES; i++) {
+        unsigned long before;
+        unsigned long after;
+        if (!lookup(baseline, baseline_size, cases[i].name, &before) ||
+            !lookup(current, current_size, cases[i].name, &after)) {
+            continue;
+        }
+        long change = before ? (long)(((long long)after - (long long)before) * 100 / (long long)before) : 0;
+        snprintf(line, sizeof(line), "%s %lu %lu %+ld", cases[i].name, before, after, change);
+        emit(ctx, line);
+    }
+}
+
+#endif
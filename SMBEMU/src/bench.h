@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include "nes.h"
+#include "nes_prof.h"
+
+#ifdef NES_BENCH
+void bench_run(nes_t *nes, nes_report_fn emit, void *ctx);
+void bench_compare(const char *baseline, size_t baseline_size, const char *current,
+                   size_t current_size, nes_report_fn emit, void *ctx);
+#endif
+
+#endif
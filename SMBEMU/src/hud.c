@@ -0,0 +1,76 @@
+#include "hud.h"
+#include <graphx.h>
+#include <string.h>
+
+#define HUD_TICKS_PER_SECOND 32768u
+#define HUD_TEXT_COLOR 0x30
+#define HUD_RIGHT_X (320 - 32)
+
+static void restart_window(hud_t *hud, const pace_t *pace) {
+    hud->frames = 0;
+    hud->elapsed = 0;
+    hud->cpu = 0;
+    hud->render = 0;
+    hud->snapshot = 0;
+    hud->last_mark = pace->mark;
+    hud->last_skipped = pace->skipped;
+}
+
+/* Toggles on the key press edge, not while the key is held. */
+void hud_key(hud_t *hud, bool pressed, const pace_t *pace) {
+    if (pressed && !hud->key_held) {
+        hud->enabled = !hud->enabled;
+        if (hud->enabled) {
+            restart_window(hud, pace);
+            hud->fps = 0;
+            hud->cpu_pct = 0;
+            hud->render_pct = 0;
+            hud->skip = 0;
+            hud->snapshot_us = 0;
+        }
+    }
+    hud->key_held = pressed;
+}
+
+/* Accumulates the last paced frame; the shown numbers change once every
+ * HUD_WINDOW frames so the overlay stays readable. */
+void hud_update(hud_t *hud, const pace_t *pace) {
+    if (!hud->enabled) {
+        return;
+    }
+    hud->elapsed += pace->mark - hud->last_mark;
+    hud->last_mark = pace->mark;
+    hud->cpu += pace->current.cpu;
+    hud->render += pace->current.render;
+    hud->snapshot += pace->current.snapshot;
+    if (++hud->frames < HUD_WINDOW) {
+        return;
+    }
+    if (hud->elapsed) {
+        hud->fps = (uint8_t)(hud->frames * HUD_TICKS_PER_SECOND / hud->elapsed);
+        hud->cpu_pct = (uint8_t)(hud->cpu * 100u / hud->elapsed);
+        hud->render_pct = (uint8_t)(hud->render * 100u / hud->elapsed);
+    }
+    hud->skip = (uint8_t)(pace->skipped - hud->last_skipped);
+    /* Ticks to microseconds: 1000000 / 32768 = 15625 / 512. */
+    hud->snapshot_us = (uint16_t)(hud->snapshot * 15625u / 512u / hud->frames);
+    restart_window(hud, pace);
+}
+
+static void draw_stat(int x, int y, const char *label, unsigned int value) {
+    gfx_SetTextXY(x, y);
+    gfx_PrintString(label);
+    gfx_SetTextXY(x, y + 10);
+    gfx_PrintUInt(value, 3);
+}
+
+void hud_draw(const hud_t *hud) {
+    gfx_SetTextFGColor(HUD_TEXT_COLOR);
+    draw_stat(4, 8, "FPS", hud->fps);
+    draw_stat(4, 40, "CPU", hud->cpu_pct);
+    draw_stat(HUD_RIGHT_X + 4, 8, "PPU", hud->render_pct);
+    draw_stat(HUD_RIGHT_X + 4, 40, "SKP", hud->skip);
+#ifdef NES_RUNAHEAD
+    draw_stat(4, 72, "SNP", hud->snapshot_us);
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pace.h"
+
+#define HUD_WINDOW 30
+
+typedef struct {
+    bool enabled;
+    bool key_held;
+    uint8_t frames;
+    uint32_t last_mark;
+    uint32_t last_skipped;
+    uint32_t elapsed;
+    uint32_t cpu;
+    uint32_t render;
+    uint32_t snapshot;
+    uint8_t fps;
+    uint8_t cpu_pct;
+    uint8_t render_pct;
+    uint8_t skip;
+    uint16_t snapshot_us;
+} hud_t;
+
+void hud_key(hud_t *hud, bool pressed, const pace_t *pace);
+void hud_update(hud_t *hud, const pace_t *pace);
+void hud_draw(const hud_t *hud);
+
+#endif
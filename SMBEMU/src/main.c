@@ -1,16 +1,41 @@
 #include <tice.h>
 #include <graphx.h>
 #include <keypadc.h>
+#include <fileioc.h>
+#include <stdio.h>
 #include <string.h>
 #include "nes.h"
 #include "nes_cpu.h"
 #include "nes_ppu.h"
 #include "nes_mem.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_audio.h"
 #include "rom.h"
+#include "pace.h"
+#include "hud.h"
+#include "nes_prof.h"
+#include "nes_trace.h"
+#include "nes_movie.h"
+#include "bench.h"
+#include "nes_snap.h"
+#include "nes_debug.h"
+#include "nes_perf.h"
 
-static uint8_t read_controller(void) {
+static bool keys_scanned;
+
+/* Scans at most once per frame no matter how often the game strobes. */
+static void scan_keys(void) {
+    if (!keys_scanned) {
+        kb_Scan();
+        keys_scanned = true;
+    }
+}
+
+static uint8_t read_controller(void *ctx) {
     uint8_t state = 0;
-    kb_Scan();
+    (void)ctx;
+    scan_keys();
     if (kb_Data[1] & kb_2nd) {
         state |= 0x01;
     }
@@ -54,36 +79,537 @@ static void show_error(const char *msg) {
     gfx_End();
 }
 
+#if defined(NES_PROFILE) || defined(NES_TRACE) || defined(NES_BENCH) || defined(NES_DEBUG) || defined(NES_PERF)
+static void write_report_line(void *ctx, const char *line) {
+    ti_var_t handle = *(ti_var_t *)ctx;
+    ti_Write(line, strlen(line), 1, handle);
+    ti_Write("\n", 1, 1, handle);
+}
+#endif
+
+#ifdef NES_PROFILE
+/* Writes the profile to SMBPROF, symbolised with SMBLBL when present. */
+static void dump_profile(void) {
+    const char *labels = NULL;
+    size_t labels_size = 0;
+    ti_var_t label_handle = ti_Open("SMBLBL", "r");
+    if (label_handle) {
+        labels = ti_GetDataPtr(label_handle);
+        labels_size = ti_GetSize(label_handle);
+    }
+    ti_var_t handle = ti_Open("SMBPROF", "w");
+    if (handle) {
+        nes_prof_report(write_report_line, &handle, labels, labels_size);
+        ti_Close(handle);
+    }
+    if (label_handle) {
+        ti_Close(label_handle);
+    }
+}
+#endif
+
+#ifdef NES_PERF
+/* Writes the event counters to SMBPERF. */
+static void dump_perf(void) {
+    ti_var_t handle = ti_Open("SMBPERF", "w");
+    if (handle) {
+        nes_perf_report(write_report_line, &handle);
+        ti_Close(handle);
+    }
+}
+#endif
+
+#ifdef NES_TRACE
+static nes_trace_t trace;
+
+/* Compares against the SMBREF log and starts at its first PC, which runs
+ * nestest.nes in its automated mode. */
+static ti_var_t start_trace(nes_t *nes) {
+    const char *ref = NULL;
+    size_t ref_size = 0;
+    ti_var_t handle = ti_Open("SMBREF", "r");
+    if (handle) {
+        ref = ti_GetDataPtr(handle);
+        ref_size = ti_GetSize(handle);
+    }
+    nes_trace_start(&trace, ref, ref_size);
+    uint16_t pc;
+    if (nes_trace_entry_pc(&trace, &pc)) {
+        nes->cpu.pc = pc;
+    }
+    return handle;
+}
+
+static void finish_trace(ti_var_t ref_handle) {
+    ti_var_t handle = ti_Open("SMBTRC", "w");
+    if (handle) {
+        nes_trace_report(&trace, write_report_line, &handle);
+        ti_Close(handle);
+    }
+    if (ref_handle) {
+        ti_Close(ref_handle);
+    }
+    if (trace.diverged) {
+        show_error("CPU trace diverged, see SMBTRC");
+    }
+}
+#endif
+#ifdef NES_BENCH
+/* Writes benchmark results to SMBBENCH as JSON and, when a previous run was
+ * saved as SMBBASE, the per-case change to SMBCMP. */
+static void run_bench(nes_t *nes) {
+    gfx_FillScreen(0);
+    gfx_SetTextFGColor(255);
+    gfx_PrintStringXY("Running benchmarks...", 10, 10);
+    gfx_SwapDraw();
+    ti_var_t handle = ti_Open("SMBBENCH", "w");
+    if (!handle) {
+        return;
+    }
+    bench_run(nes, write_report_line, &handle);
+    ti_Close(handle);
+
+    ti_var_t base_handle = ti_Open("SMBBASE", "r");
+    if (!base_handle) {
+        return;
+    }
+    handle = ti_Open("SMBBENCH", "r");
+    ti_var_t cmp_handle = ti_Open("SMBCMP", "w");
+    if (handle && cmp_handle) {
+        bench_compare(ti_GetDataPtr(base_handle), ti_GetSize(base_handle),
+                      ti_GetDataPtr(handle), ti_GetSize(handle), write_report_line, &cmp_handle);
+    }
+    if (cmp_handle) {
+        ti_Close(cmp_handle);
+    }
+    if (handle) {
+        ti_Close(handle);
+    }
+    ti_Close(base_handle);
+}
+#endif
+
+#ifdef NES_FRAMEHASH
+static nes_movie_t movie;
+static ti_var_t hash_handle;
+
+/* Replays SMBMOVIE, writes every frame hash to SMBHASH and compares them
+ * with SMBGOLD when it exists. */
+static bool start_movie(nes_t *nes, ti_var_t *movie_handle, ti_var_t *golden_handle) {
+    *movie_handle = ti_Open("SMBMOVIE", "r");
+    if (!*movie_handle) {
+        return false;
+    }
+    const char *golden = NULL;
+    size_t golden_size = 0;
+    *golden_handle = ti_Open("SMBGOLD", "r");
+    if (*golden_handle) {
+        golden = ti_GetDataPtr(*golden_handle);
+        golden_size = ti_GetSize(*golden_handle);
+    }
+    nes_movie_start(&movie, ti_GetDataPtr(*movie_handle), ti_GetSize(*movie_handle), golden, golden_size);
+    nes_set_input_provider(nes, nes_movie_input, &movie);
+    hash_handle = ti_Open("SMBHASH", "w");
+    return hash_handle != 0;
+}
+
+/* The first mismatching frame is kept in SMBFRAME as raw palette indices,
+ * 256x240, for conversion to an image with tools/export.c. */
+static void dump_frame(const uint8_t *buffer) {
+    ti_var_t handle = ti_Open("SMBFRAME", "w");
+    if (!handle) {
+        return;
+    }
+    const uint8_t *row = buffer + (320 - NES_SCREEN_WIDTH) / 2;
+    for (int y = 0; y < NES_SCREEN_HEIGHT; y++) {
+        ti_Write(row, NES_SCREEN_WIDTH, 1, handle);
+        row += 320;
+    }
+    ti_Close(handle);
+}
+
+static void check_frame_hash(const uint8_t *buffer) {
+    char line[17];
+    uint64_t hash = nes_ppu_frame_hash(buffer);
+    nes_movie_format_hash(hash, line);
+    ti_Write(line, 16, 1, hash_handle);
+    ti_Write("\n", 1, 1, hash_handle);
+    if (!nes_movie_check(&movie, hash) && movie.mismatches == 1) {
+        dump_frame(buffer);
+    }
+}
+
+static void finish_movie(ti_var_t movie_handle, ti_var_t golden_handle) {
+    static char message[48];
+    ti_Close(hash_handle);
+    ti_Close(movie_handle);
+    if (golden_handle) {
+        ti_Close(golden_handle);
+    }
+    if (movie.mismatches) {
+        sprintf(message, "%lu frame mismatches, first %lu",
+                (unsigned long)movie.mismatches, (unsigned long)movie.first_mismatch);
+        show_error(message);
+    }
+}
+#endif
+
+#ifdef NES_SNAPSHOT
+#if defined(NES_TRACE) || defined(NES_FRAMEHASH) || defined(NES_BENCH)
+#error "SNAPSHOT changes the boot state that TRACE, FRAMEHASH and BENCH rely on"
+#endif
+static uint32_t rom_hash;
+static bool snapshot_key_held;
+
+/* Restores SMBSNAP when it was saved by this build from this ROM. */
+static bool load_snapshot(nes_t *nes) {
+    ti_var_t handle = ti_Open("SMBSNAP", "r");
+    if (!handle) {
+        return false;
+    }
+    bool restored = nes_snap_restore(nes, rom_hash, ti_GetDataPtr(handle), ti_GetSize(handle));
+    ti_Close(handle);
+    return restored;
+}
+
+static void save_snapshot(const nes_t *nes) {
+    nes_snap_header_t header;
+    nes_snap_header(&header, rom_hash);
+    ti_var_t handle = ti_Open("SMBSNAP", "w");
+    if (!handle) {
+        return;
+    }
+    ti_Write(&header, sizeof(header), 1, handle);
+    ti_Write(nes, sizeof(*nes), 1, handle);
+    ti_Close(handle);
+}
+
+/* Saves on the [sto->] press edge, so one press is one write. */
+static void snapshot_key(const nes_t *nes, bool pressed) {
+    if (pressed && !snapshot_key_held) {
+        save_snapshot(nes);
+    }
+    snapshot_key_held = pressed;
+}
+#endif
+
+#ifdef NES_RUNAHEAD
+#if defined(NES_TRACE) || defined(NES_FRAMEHASH)
+#error "RUNAHEAD runs frames twice, which TRACE and FRAMEHASH would see"
+#endif
+static nes_t behind;
+
+/* Keeps the real machine in behind and runs nes NES_RUNAHEAD frames further
+ * with the buttons already scanned for this frame. Nothing is drawn for the
+ * hidden frames; only the last one is captured. */
+static void run_ahead(nes_t *nes, pace_t *pace) {
+    pace_begin_snapshot(pace);
+    behind = *nes;
+    pace_end_snapshot(pace);
+    nes->audio = NULL;
+    for (int i = 0; i < NES_RUNAHEAD; i++) {
+        nes_cpu_run(nes, NES_FRAME_CYCLES);
+    }
+}
+
+static void run_behind(nes_t *nes, pace_t *pace) {
+    pace_begin_snapshot(pace);
+    *nes = behind;
+    pace_end_snapshot(pace);
+}
+#endif
+
+#ifdef NES_DEBUG
+#ifdef NES_RUNAHEAD
+#error "DEBUG would stop in hidden RUNAHEAD frames and again when they are replayed"
+#endif
+/* Loads breakpoints, watchpoints and tracing from the SMBDBG AppVar, one
+ * command per line (see nes_debug_load). Without it nothing is checked.
+ * Returns an error message when a line cannot be parsed. */
+static const char *start_debug(void) {
+    const char *error = NULL;
+    nes_debug_reset();
+    ti_var_t handle = ti_Open("SMBDBG", "r");
+    if (!handle) {
+        return NULL;
+    }
+    nes_debug_load(ti_GetDataPtr(handle), ti_GetSize(handle), &error);
+    ti_Close(handle);
+    return error;
+}
+
+/* Writes the hit and the trace to SMBDBGO and waits for a key. Returns
+ * false when the user quits. */
+static bool debug_pause(const nes_t *nes) {
+    ti_var_t handle = ti_Open("SMBDBGO", "w");
+    if (handle) {
+        nes_debug_report(nes, write_report_line, &handle);
+        ti_Close(handle);
+    }
+    char line[40];
+    snprintf(line, sizeof(line), "PC:%04X A:%02X X:%02X Y:%02X", (unsigned int)nes->cpu.pc,
+             (unsigned int)nes->cpu.a, (unsigned int)nes->cpu.x, (unsigned int)nes->cpu.y);
+    gfx_FillScreen(0);
+    gfx_SetTextFGColor(255);
+    gfx_SetTextXY(10, 10);
+    gfx_PrintString(nes_debug.hit == NES_DEBUG_HIT_BREAK ? "Breakpoint" : "Watchpoint");
+    gfx_SetTextXY(10, 30);
+    gfx_PrintString(line);
+    gfx_SetTextXY(10, 50);
+    gfx_PrintString("Report in SMBDBGO");
+    gfx_SetTextXY(10, 70);
+    gfx_PrintString("[enter] continue, [clear] quit");
+    gfx_SwapDraw();
+    for (;;) {
+        uint8_t key = os_GetCSC();
+        if (key == sk_Enter) {
+            nes_debug_resume();
+            return true;
+        }
+        if (key == sk_Clear) {
+            return false;
+        }
+    }
+}
+#endif
+
+#ifdef NES_APU
+#define AUDIO_RATE 22050
+#define AUDIO_TARGET 1024
+#define AUDIO_WAV_LIMIT 60000u
+
+static nes_apu_buffer_t audio;
+static nes_audio_ring_t audio_ring;
+static uint32_t audio_mark;
+static uint32_t audio_frac;
+static uint32_t audio_samples;
+#ifdef NES_AUDIO_WAV
+static ti_var_t wav_handle;
+static nes_audio_wav_t wav;
+
+static void write_wav(void *ctx, const void *data, size_t size) {
+    ti_Write(data, size, 1, *(ti_var_t *)ctx);
+}
+
+/* Also counts what it is given, so SMBAUD reads the same for both sinks. */
+static void audio_sink(void *ctx, const int16_t *samples, size_t count) {
+    nes_audio_null_sink(ctx, samples, count);
+    nes_audio_wav_sink(&wav, samples, count);
+}
+#else
+#define audio_sink nes_audio_null_sink
+#endif
+
+static void start_audio(nes_t *nes, uint32_t now) {
+    nes_apu_buffer_init(&audio, AUDIO_RATE);
+    nes_apu_attach(nes, &audio);
+    nes_audio_ring_init(&audio_ring);
+    audio_mark = now;
+#ifdef NES_AUDIO_WAV
+    uint8_t header[NES_AUDIO_WAV_HEADER_SIZE];
+    nes_audio_wav_header(header, AUDIO_RATE, 0);
+    wav_handle = ti_Open("SMBWAV", "w");
+    if (wav_handle) {
+        ti_Write(header, sizeof(header), 1, wav_handle);
+        wav.write = write_wav;
+        wav.ctx = &wav_handle;
+        wav.limit = AUDIO_WAV_LIMIT;
+    }
+#endif
+}
+
+/* The calculator has no audio output, so the ring is drained against the
+ * 32768 Hz timer, the way a sound card would take it, and the samples go
+ * to SMBWAV or nowhere. Long stalls are not made up for. */
+static void pump_audio(uint32_t now) {
+    uint32_t elapsed = now - audio_mark;
+    audio_mark = now;
+    if (elapsed > 32768u) {
+        elapsed = 32768u;
+    }
+    uint32_t due = audio_frac + elapsed * AUDIO_RATE;
+    audio_frac = due & 0x7FFFu;
+    nes_audio_pump(&audio_ring, audio_sink, &audio_samples, due >> 15);
+}
+
+/* SMBAUD holds the samples played, dropped and the number of underruns. */
+static void finish_audio(void) {
+#ifdef NES_AUDIO_WAV
+    if (wav_handle) {
+        uint8_t header[NES_AUDIO_WAV_HEADER_SIZE];
+        nes_audio_wav_header(header, AUDIO_RATE, wav.bytes);
+        ti_Seek(0, SEEK_SET, wav_handle);
+        ti_Write(header, sizeof(header), 1, wav_handle);
+        ti_Close(wav_handle);
+    }
+#endif
+    ti_var_t handle = ti_Open("SMBAUD", "w");
+    if (handle) {
+        ti_Write(&audio_samples, sizeof(audio_samples), 1, handle);
+        ti_Write(&audio_ring.dropped, sizeof(audio_ring.dropped), 1, handle);
+        ti_Write(&audio_ring.underruns, sizeof(audio_ring.underruns), 1, handle);
+        ti_Close(handle);
+    }
+}
+#endif
+
+static void present_frame(nes_ppu_pipe_t *pipe, const uint8_t *chr, const hud_t *hud) {
+    const nes_ppu_frame_t *frame = nes_ppu_pipe_front(pipe);
+    if (!frame) {
+        return;
+    }
+    gfx_FillScreen(0);
+    nes_ppu_draw(frame, chr, gfx_vbuffer);
+    nes_ppu_pipe_release(pipe);
+#ifdef NES_FRAMEHASH
+    check_frame_hash(gfx_vbuffer);
+#endif
+    if (hud->enabled) {
+        hud_draw(hud);
+    }
+    gfx_SwapDraw();
+}
+
 int main(void) {
-    nes_t nes;
-    memset(&nes, 0, sizeof(nes));
+    static nes_ppu_pipe_t pipe;
+    static pace_t pace;
+    static hud_t hud;
+    static nes_rom_t rom;
+    static nes_t nes;
 
     const char *error = NULL;
-    if (!rom_load_smb(&nes, &error)) {
+    if (!rom_load_smb(&rom, &error)) {
         show_error(error ? error : "ROM load failed");
         return 0;
     }
+    nes_init(&nes, &rom);
 
     gfx_Begin();
     gfx_SetDrawBuffer();
+    nes_sched_reset(&nes);
     nes_ppu_reset(&nes);
     nes_cpu_reset(&nes);
+    nes_apu_reset(&nes);
+    nes_ppu_pipe_init(&pipe);
+    nes_set_input_provider(&nes, read_controller, NULL);
+    pace_init(&pace);
+#ifdef NES_APU
+    start_audio(&nes, pace.mark);
+#endif
+#ifdef NES_SNAPSHOT
+    rom_hash = nes_rom_hash(&rom);
+    bool restored = load_snapshot(&nes);
+    uint32_t frame = 0;
+#endif
+#ifdef NES_BENCH
+    run_bench(&nes);
+    gfx_End();
+    return 0;
+#endif
+#ifdef NES_TRACE
+    ti_var_t ref_handle = start_trace(&nes);
+#endif
+#ifdef NES_FRAMEHASH
+    ti_var_t movie_handle;
+    ti_var_t golden_handle;
+    if (!start_movie(&nes, &movie_handle, &golden_handle)) {
+        gfx_End();
+        show_error("SMBMOVIE AppVar not found");
+        return 0;
+    }
+#endif
+#ifdef NES_DEBUG
+    const char *debug_error = start_debug();
+    if (debug_error) {
+        gfx_End();
+        show_error(debug_error);
+        return 0;
+    }
+#endif
 
     bool running = true;
     while (running) {
-        uint8_t controller = read_controller();
-        nes_set_controller(&nes, controller);
+        keys_scanned = false;
+        nes_cpu_run(&nes, NES_FRAME_CYCLES);
+#ifdef NES_DEBUG
+        if (nes_debug.hit && !debug_pause(&nes)) {
+            break;
+        }
+#endif
+#ifdef NES_APU
+        nes_audio_produce(&nes, &audio_ring);
+        nes_audio_control_rate(&audio, &audio_ring, AUDIO_TARGET);
+#endif
+        scan_keys();
         if (kb_Data[6] & kb_Clear) {
             running = false;
         }
-        int cycles = 0;
-        while (cycles < 29780) {
-            cycles += nes_cpu_step(&nes);
+#ifdef NES_TRACE
+        if (trace.diverged) {
+            running = false;
+        }
+#endif
+#ifdef NES_FRAMEHASH
+        if (nes_movie_done(&movie)) {
+            running = false;
+        }
+#endif
+        hud_key(&hud, (kb_Data[1] & kb_Yequ) != 0, &pace);
+#ifdef NES_SNAPSHOT
+        if (!restored && ++frame == NES_SNAPSHOT_FRAME) {
+            save_snapshot(&nes);
+        }
+        snapshot_key(&nes, (kb_Data[2] & kb_Sto) != 0);
+#endif
+#ifdef NES_FRAMEHASH
+        bool render = true;
+#else
+        bool render = pace_should_render(&pace);
+#endif
+#ifdef NES_RUNAHEAD
+        if (render) {
+            run_ahead(&nes, &pace);
+        }
+#endif
+        pace_end_cpu(&pace);
+        if (render) {
+            nes_ppu_frame_t *back = nes_ppu_pipe_back(&pipe);
+            if (back) {
+                nes_ppu_capture(&nes, back);
+                nes_ppu_pipe_publish(&pipe);
+            }
+#ifdef NES_RUNAHEAD
+            run_behind(&nes, &pace);
+#endif
+            present_frame(&pipe, nes.chr, &hud);
+            pace_end_render(&pace);
+            NES_PERF_COUNT(frames_rendered);
+        } else {
+            NES_PERF_COUNT(frames_skipped);
         }
-        nes_ppu_render_frame(&nes);
-        gfx_SwapDraw();
+        pace_wait(&pace);
+#ifdef NES_APU
+        pump_audio(pace.mark);
+#endif
+        hud_update(&hud, &pace);
     }
 
     gfx_End();
+    pace_dump(&pace, "SMBPACE");
+#ifdef NES_APU
+    finish_audio();
+#endif
+#ifdef NES_PROFILE
+    dump_profile();
+#endif
+#ifdef NES_PERF
+    dump_perf();
+#endif
+#ifdef NES_TRACE
+    finish_trace(ref_handle);
+#endif
+#ifdef NES_FRAMEHASH
+    finish_movie(movie_handle, golden_handle);
+#endif
     return 0;
 }
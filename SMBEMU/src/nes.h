@@ -3,9 +3,11 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "nes_atomic.h"
 
 #define NES_RAM_SIZE 0x0800
 #define NES_NAMETABLE_SIZE 0x0800
+#define NES_NAMETABLE_PAGE 0x0400
 #define NES_PALETTE_SIZE 0x20
 #define NES_OAM_SIZE 256
 #define NES_CHR_SIZE 0x2000
@@ -14,6 +16,11 @@
 #define NES_SCREEN_WIDTH 256
 #define NES_SCREEN_HEIGHT 240
 
+#define NES_FRAME_CYCLES 29780
+#define NES_VBLANK_CYCLE 27393
+#define NES_OAM_DMA_CYCLES 513
+#define NES_MAX_EVENTS 8
+
 #define FLAG_C 0x01
 #define FLAG_Z 0x02
 #define FLAG_I 0x04
@@ -33,6 +40,36 @@ typedef struct {
     bool nmi_pending;
 } nes_cpu_t;
 
+typedef enum {
+    NES_EVENT_FRAME_START,
+    NES_EVENT_SPRITE0,
+    NES_EVENT_VBLANK,
+    NES_EVENT_APU
+} nes_event_kind_t;
+
+typedef struct {
+    uint32_t time;
+    uint8_t kind;
+} nes_event_t;
+
+typedef struct {
+    uint32_t now;
+    uint32_t target;
+    uint32_t deadline; /* end of the current nes_cpu_run slice */
+    nes_event_t events[NES_MAX_EVENTS];
+    uint8_t count;
+} nes_sched_t;
+
+/* How the four logical nametables at $2000-$2FFF map onto the console's
+ * two VRAM pages. Four-screen boards bring 2 KB more VRAM of their own;
+ * they are rejected at load rather than growing every instance by it. */
+typedef enum {
+    NES_MIRROR_HORIZONTAL,
+    NES_MIRROR_VERTICAL,
+    NES_MIRROR_SINGLE_LOW,
+    NES_MIRROR_SINGLE_HIGH
+} nes_mirroring_t;
+
 typedef struct {
     uint8_t ctrl;
     uint8_t mask;
@@ -40,8 +77,9 @@ typedef struct {
     uint8_t oam_addr;
     uint8_t oam[NES_OAM_SIZE];
     uint8_t nametable[NES_NAMETABLE_SIZE];
+    uint16_t nametable_page[4];
+    uint8_t mirroring;
     uint8_t palette[NES_PALETTE_SIZE];
-    uint8_t chr[NES_CHR_SIZE];
     uint16_t vram_addr;
     uint16_t temp_addr;
     uint8_t fine_x;
@@ -51,14 +89,124 @@ typedef struct {
     uint8_t data_buffer;
 } nes_ppu_t;
 
+/* APU channel state. Timers are not stepped per cycle; next holds the CPU
+ * cycle of a channel's next timer clock, see nes_apu.c. */
+typedef struct {
+    uint8_t volume;
+    uint8_t decay;
+    uint8_t divider;
+    bool start;
+    bool constant;
+    bool loop;
+} nes_envelope_t;
+
+typedef struct {
+    nes_envelope_t envelope;
+    uint8_t duty;
+    uint8_t step;
+    uint8_t length;
+    uint16_t period;
+    uint32_t next;
+    uint8_t sweep;
+    uint8_t sweep_divider;
+    bool sweep_reload;
+} nes_pulse_t;
+
+typedef struct {
+    uint8_t control;
+    uint8_t linear;
+    bool linear_reload;
+    uint8_t length;
+    uint8_t step;
+    uint16_t period;
+    uint32_t next;
+} nes_triangle_t;
+
+typedef struct {
+    nes_envelope_t envelope;
+    uint8_t length;
+    bool mode;
+    uint16_t period;
+    uint16_t lfsr;
+    uint32_t next;
+} nes_noise_t;
+
+typedef struct {
+    uint8_t control;
+    uint8_t level;
+    uint16_t sample_addr;
+    uint16_t sample_length;
+    uint16_t addr;
+    uint16_t remaining;
+    uint8_t buffer;
+    bool buffer_full;
+    uint8_t shift;
+    uint8_t bits;
+    bool silence;
+    uint16_t period;
+    uint32_t next;
+} nes_dmc_t;
+
+typedef struct {
+    nes_pulse_t pulse[2];
+    nes_triangle_t triangle;
+    nes_noise_t noise;
+    nes_dmc_t dmc;
+    uint8_t enabled;
+    uint8_t frame_mode;
+    uint8_t frame_step;
+    uint32_t frame_start;
+    uint32_t frame_next;
+    bool frame_irq;
+    bool dmc_irq;
+    uint32_t time;
+    int32_t mix;
+} nes_apu_t;
+
+struct nes_apu_buffer;
+
+typedef uint8_t (*nes_input_fn)(void *ctx);
+
+/* Bank storage for loaders that copy the cartridge, e.g. into RAM or to
+ * mirror a 16 KB PRG up to 32 KB. */
+typedef struct {
+    uint8_t prg[NES_PRG_SIZE];
+    uint8_t chr[NES_CHR_SIZE];
+} nes_rom_banks_t;
+
+/* A loaded cartridge. The banks are read-only and live wherever the
+ * loader put them, a static copy on the calculator or a file mapping on a
+ * host, so any number of instances share one image and a nes_t holds only
+ * the two pointers. Owners that outlive each other share it through
+ * nes_rom_retain and nes_rom_release; release runs when the last one lets
+ * go. */
+typedef struct nes_rom {
+    const uint8_t *prg;
+    const uint8_t *chr;
+    uint8_t mirroring;
+    nes_atomic_t refs;
+    void (*release)(struct nes_rom *rom);
+} nes_rom_t;
+
+/* Per-instance state, about 4.5 KB. The first group is touched by every
+ * instruction and is kept together at the front; PPU and controller state
+ * follow, and ROM is only referenced. Storage is up to the caller: a
+ * static, an array for batch runs, or a heap block, set up by nes_init. */
 typedef struct {
     nes_cpu_t cpu;
-    nes_ppu_t ppu;
+    nes_sched_t sched;
+    const uint8_t *prg;
     uint8_t ram[NES_RAM_SIZE];
-    uint8_t prg[NES_PRG_SIZE];
+
+    nes_ppu_t ppu;
+    nes_apu_t apu;
+    const uint8_t *chr;
+    struct nes_apu_buffer *audio;
     uint8_t controller_state;
     uint8_t controller_shift;
     bool controller_strobe;
+    nes_input_fn input_provider;
+    void *input_ctx;
 } nes_t;
 
 #endif
@@ -0,0 +1,691 @@
+#include "nes_apu.h"
+
+#ifdef NES_APU
+
+#include <string.h>
+#include "nes_mem.h"
+#include "nes_sched.h"
+
+/* The APU is only brought up to date when the CPU touches its registers,
+ * when samples are read, or at its own scheduled event (frame and DMC IRQs).
+ * Catching up walks the channel timers in time order, jumping from one
+ * timer clock to the next, and adds a band-limited step to the output
+ * buffer wherever the mixed level changes. Without a buffer attached only
+ * the frame sequencer and DMC run, which is all $4015 and the IRQs need.
+ *
+ * DMC fetches do not stall the CPU, and an IRQ that is already pending when
+ * the game clears the I flag is taken at the next scheduler event. */
+
+#define CPU_CLOCK 1789773u
+#define FRAME_QUARTER 7457u
+#define MAX_CYCLES 131072u
+#define POS_BITS 20
+#define PHASE_BITS 5
+
+static const uint8_t length_table[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t duty_table[4] = { 0x02, 0x06, 0x1E, 0xF9 };
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+static const uint16_t noise_periods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const uint16_t dmc_periods[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+/* Frame sequencer step positions from the start of a sequence; four-step
+ * sequences are 29830 cycles long and five-step ones 37282. */
+static const uint16_t frame_positions[5] = { 7457, 14913, 22371, 29829, 37281 };
+
+/* Nonlinear mixer, 95.52 / (8128 / n + 100) and 163.67 / (24329 / n + 100),
+ * scaled so the two together stay under 24000. */
+static const int16_t pulse_table[31] = {
+    0, 279, 551, 816, 1075, 1329, 1576, 1818, 2054, 2285, 2511, 2733,
+    2949, 3161, 3368, 3572, 3771, 3965, 4156, 4344, 4527, 4707, 4883, 5056,
+    5226, 5393, 5556, 5716, 5874, 6028, 6180
+};
+
+static const int16_t tnd_table[203] = {
+    0, 161, 320, 478, 635, 791, 945, 1099, 1251, 1401, 1551, 1699,
+    1846, 1992, 2137, 2281, 2424, 2565, 2706, 2845, 2984, 3121, 3257, 3393,
+    3527, 3660, 3793, 3924, 4054, 4184, 4312, 4439, 4566, 4692, 4816, 4940,
+    5063, 5185, 5307, 5427, 5546, 5665, 5783, 5900, 6016, 6131, 6246, 6360,
+    6473, 6585, 6697, 6807, 6917, 7027, 7135, 7243, 7350, 7456, 7562, 7667,
+    7771, 7874, 7977, 8080, 8181, 8282, 8382, 8482, 8581, 8679, 8777, 8874,
+    8970, 9066, 9161, 9256, 9350, 9443, 9536, 9629, 9720, 9811, 9902, 9992,
+    10082, 10170, 10259, 10347, 10434, 10521, 10607, 10693, 10778, 10863, 10947, 11031,
+    11114, 11197, 11279, 11361, 11442, 11523, 11604, 11684, 11763, 11842, 11921, 11999,
+    12076, 12154, 12230, 12307, 12383, 12458, 12533, 12608, 12682, 12756, 12829, 12902,
+    12975, 13047, 13119, 13190, 13262, 13332, 13402, 13472, 13542, 13611, 13680, 13748,
+    13816, 13884, 13951, 14018, 14085, 14151, 14217, 14282, 14348, 14413, 14477, 14541,
+    14605, 14669, 14732, 14795, 14857, 14920, 14982, 15043, 15105, 15166, 15226, 15287,
+    15347, 15407, 15466, 15525, 15584, 15643, 15701, 15759, 15817, 15874, 15932, 15988,
+    16045, 16101, 16158, 16213, 16269, 16324, 16379, 16434, 16488, 16543, 16597, 16650,
+    16704, 16757, 16810, 16863, 16915, 16967, 17019, 17071, 17123, 17174, 17225, 17276,
+    17326, 17377, 17427, 17476, 17526, 17576, 17625, 17674, 17722, 17771, 17819
+};
+
+/* Blackman-windowed sinc impulses at 32 sub-sample phases. Each row sums to
+ * 32768, so once integrated a step settles at exactly its height. */
+static const int16_t step_kernel[1 << PHASE_BITS][NES_APU_KERNEL_WIDTH] = {
+    { 228, -1435, 3663, 27856, 3663, -1435, 228, 0 },
+    { 207, -1275, 2910, 27815, 4458, -1597, 250, 0 },
+    { 185, -1118, 2200, 27699, 5291, -1759, 271, -1 },
+    { 164, -967, 1536, 27504, 6161, -1921, 292, -1 },
+    { 145, -821, 917, 27232, 7065, -2079, 311, -2 },
+    { 126, -682, 345, 26887, 7999, -2233, 329, -3 },
+    { 108, -551, -180, 26470, 8959, -2379, 345, -4 },
+    { 91, -427, -657, 25982, 9942, -2517, 359, -5 },
+    { 76, -313, -1086, 25426, 10943, -2642, 369, -5 },
+    { 62, -207, -1469, 24808, 11958, -2754, 376, -6 },
+    { 50, -111, -1805, 24129, 12982, -2850, 379, -6 },
+    { 39, -24, -2097, 23394, 14011, -2926, 377, -6 },
+    { 29, 54, -2345, 22609, 15039, -2981, 369, -6 },
+    { 21, 122, -2551, 21775, 16061, -3011, 356, -5 },
+    { 14, 182, -2716, 20899, 17072, -3016, 336, -3 },
+    { 8, 232, -2843, 19985, 18067, -2990, 309, 0 },
+    { 3, 275, -2934, 19040, 19040, -2934, 275, 3 },
+    { 0, 309, -2990, 18067, 19985, -2843, 232, 8 },
+    { -3, 336, -3016, 17072, 20899, -2716, 182, 14 },
+    { -5, 356, -3011, 16061, 21775, -2551, 122, 21 },
+    { -6, 369, -2981, 15040, 22608, -2345, 54, 29 },
+    { -6, 377, -2926, 14010, 23395, -2097, -24, 39 },
+    { -6, 379, -2850, 12982, 24129, -1805, -111, 50 },
+    { -6, 376, -2754, 11958, 24808, -1469, -207, 62 },
+    { -5, 369, -2642, 10942, 25427, -1086, -313, 76 },
+    { -5, 359, -2517, 9943, 25981, -657, -427, 91 },
+    { -4, 345, -2379, 8960, 26469, -180, -551, 108 },
+    { -3, 329, -2233, 7999, 26887, 345, -682, 126 },
+    { -2, 311, -2079, 7064, 27233, 917, -821, 145 },
+    { -1, 292, -1921, 6162, 27503, 1536, -967, 164 },
+    { -1, 271, -1759, 5292, 27698, 2200, -1118, 185 },
+    { 0, 250, -1597, 4458, 27815, 2910, -1275, 207 }
+};
+
+static bool before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static void add_delta(nes_apu_buffer_t *buffer, uint32_t time, int32_t delta) {
+    uint32_t cycles = time - buffer->base_time;
+    if (cycles > MAX_CYCLES) {
+        return;
+    }
+    uint32_t pos = cycles * buffer->factor + buffer->base_pos;
+    uint32_t index = pos >> POS_BITS;
+    if (index >= NES_APU_BUFFER_SAMPLES) {
+        return;
+    }
+    const int16_t *kernel = step_kernel[(pos >> (POS_BITS - PHASE_BITS)) & ((1 << PHASE_BITS) - 1)];
+    int32_t *out = buffer->deltas + index;
+    for (int i = 0; i < NES_APU_KERNEL_WIDTH; i++) {
+        out[i] += delta * kernel[i];
+    }
+}
+
+static uint8_t envelope_volume(const nes_envelope_t *envelope) {
+    return envelope->constant ? envelope->volume : envelope->decay;
+}
+
+static void clock_envelope(nes_envelope_t *envelope) {
+    if (envelope->start) {
+        envelope->start = false;
+        envelope->decay = 15;
+        envelope->divider = envelope->volume;
+    } else if (envelope->divider == 0) {
+        envelope->divider = envelope->volume;
+        if (envelope->decay) {
+            envelope->decay--;
+        } else if (envelope->loop) {
+            envelope->decay = 15;
+        }
+    } else {
+        envelope->divider--;
+    }
+}
+
+static uint16_t sweep_target(const nes_pulse_t *pulse, int channel) {
+    uint16_t change = pulse->period >> (pulse->sweep & 7);
+    if (pulse->sweep & 0x08) {
+        return (uint16_t)(pulse->period - change - (channel == 0 ? 1 : 0));
+    }
+    return (uint16_t)(pulse->period + change);
+}
+
+static bool pulse_audible(const nes_pulse_t *pulse, int channel) {
+    return pulse->length && pulse->period >= 8 && sweep_target(pulse, channel) <= 0x7FF;
+}
+
+static uint8_t pulse_output(const nes_pulse_t *pulse, int channel) {
+    if (!pulse_audible(pulse, channel) || !((duty_table[pulse->duty] >> pulse->step) & 1)) {
+        return 0;
+    }
+    return envelope_volume(&pulse->envelope);
+}
+
+static bool triangle_running(const nes_triangle_t *triangle) {
+    return triangle->linear && triangle->length && triangle->period >= 2;
+}
+
+static uint8_t noise_output(const nes_noise_t *noise) {
+    if (!noise->length || (noise->lfsr & 1)) {
+        return 0;
+    }
+    return envelope_volume(&noise->envelope);
+}
+
+static void mix(nes_t *nes, uint32_t time) {
+    nes_apu_t *apu = &nes->apu;
+    int32_t level = pulse_table[pulse_output(&apu->pulse[0], 0) + pulse_output(&apu->pulse[1], 1)] +
+                    tnd_table[3 * triangle_table[apu->triangle.step] + 2 * noise_output(&apu->noise) +
+                              apu->dmc.level];
+    if (level != apu->mix) {
+        add_delta(nes->audio, time, level - apu->mix);
+        apu->mix = level;
+    }
+}
+
+static void dmc_restart(nes_dmc_t *dmc) {
+    dmc->addr = dmc->sample_addr;
+    dmc->remaining = dmc->sample_length;
+}
+
+static void dmc_fetch(nes_t *nes) {
+    nes_dmc_t *dmc = &nes->apu.dmc;
+    if (dmc->buffer_full || !dmc->remaining) {
+        return;
+    }
+    dmc->buffer = nes_cpu_read(nes, dmc->addr);
+    dmc->buffer_full = true;
+    dmc->addr = dmc->addr == 0xFFFF ? 0x8000 : (uint16_t)(dmc->addr + 1);
+    if (--dmc->remaining == 0) {
+        if (dmc->control & 0x40) {
+            dmc_restart(dmc);
+        } else if (dmc->control & 0x80) {
+            nes->apu.dmc_irq = true;
+        }
+    }
+}
+
+static void clock_dmc(nes_t *nes) {
+    nes_dmc_t *dmc = &nes->apu.dmc;
+    dmc->next += dmc->period;
+    if (!dmc->silence) {
+        if (dmc->shift & 1) {
+            if (dmc->level <= 125) {
+                dmc->level += 2;
+            }
+        } else if (dmc->level >= 2) {
+            dmc->level -= 2;
+        }
+    }
+    dmc->shift >>= 1;
+    if (--dmc->bits == 0) {
+        dmc->bits = 8;
+        dmc->silence = !dmc->buffer_full;
+        dmc->shift = dmc->buffer;
+        dmc->buffer_full = false;
+        dmc_fetch(nes);
+    }
+}
+
+/* Channels that cannot change their output sit out of the timer walk; a
+ * stale next is pulled up to the current time when they come back. */
+static bool due(uint32_t *next, uint32_t now, uint32_t *earliest) {
+    if (before(*next, now)) {
+        *next = now;
+    }
+    if (before(*next, *earliest)) {
+        *earliest = *next;
+        return true;
+    }
+    return false;
+}
+
+/* An idle DMC keeps counting out silent bytes; skipping those only shifts
+ * where the first bit of the next sample lands. */
+static bool dmc_active(const nes_dmc_t *dmc) {
+    return !dmc->silence || dmc->buffer_full || dmc->remaining;
+}
+
+/* Runs every channel clock up to and including until, in time order. */
+static void run_channels(nes_t *nes, uint32_t until) {
+    nes_apu_t *apu = &nes->apu;
+    bool audible = nes->audio != NULL;
+    for (;;) {
+        uint32_t earliest = until + 1u;
+        int channel = -1;
+        if (audible) {
+            for (int i = 0; i < 2; i++) {
+                if (pulse_audible(&apu->pulse[i], i) && due(&apu->pulse[i].next, apu->time, &earliest)) {
+                    channel = i;
+                }
+            }
+            if (triangle_running(&apu->triangle) && due(&apu->triangle.next, apu->time, &earliest)) {
+                channel = 2;
+            }
+            if (apu->noise.length && due(&apu->noise.next, apu->time, &earliest)) {
+                channel = 3;
+            }
+        }
+        if (dmc_active(&apu->dmc) && due(&apu->dmc.next, apu->time, &earliest)) {
+            channel = 4;
+        }
+        if (channel < 0) {
+            break;
+        }
+        apu->time = earliest;
+        switch (channel) {
+        case 0:
+        case 1: {
+            nes_pulse_t *pulse = &apu->pulse[channel];
+            pulse->next += (uint32_t)(pulse->period + 1) * 2u;
+            pulse->step = (uint8_t)((pulse->step + 1) & 7);
+            break;
+        }
+        case 2:
+            apu->triangle.next += apu->triangle.period + 1u;
+            apu->triangle.step = (uint8_t)((apu->triangle.step + 1) & 31);
+            break;
+        case 3: {
+            nes_noise_t *noise = &apu->noise;
+            uint16_t feedback = (noise->lfsr ^ (noise->lfsr >> (noise->mode ? 6 : 1))) & 1;
+            noise->next += noise->period;
+            noise->lfsr = (uint16_t)((noise->lfsr >> 1) | (feedback << 14));
+            break;
+        }
+        default:
+            clock_dmc(nes);
+            break;
+        }
+        if (audible) {
+            mix(nes, earliest);
+        }
+    }
+    apu->time = until;
+}
+
+static void clock_quarter(nes_apu_t *apu) {
+    clock_envelope(&apu->pulse[0].envelope);
+    clock_envelope(&apu->pulse[1].envelope);
+    clock_envelope(&apu->noise.envelope);
+    nes_triangle_t *triangle = &apu->triangle;
+    if (triangle->linear_reload) {
+        triangle->linear = triangle->control & 0x7F;
+    } else if (triangle->linear) {
+        triangle->linear--;
+    }
+    if (!(triangle->control & 0x80)) {
+        triangle->linear_reload = false;
+    }
+}
+
+static void clock_half(nes_apu_t *apu) {
+    for (int i = 0; i < 2; i++) {
+        nes_pulse_t *pulse = &apu->pulse[i];
+        if (pulse->length && !pulse->envelope.loop) {
+            pulse->length--;
+        }
+        if (pulse->sweep_divider == 0 && (pulse->sweep & 0x80) && (pulse->sweep & 7) &&
+            pulse_audible(pulse, i)) {
+            pulse->period = sweep_target(pulse, i);
+        }
+        if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+            pulse->sweep_divider = (pulse->sweep >> 4) & 7;
+            pulse->sweep_reload = false;
+        } else {
+            pulse->sweep_divider--;
+        }
+    }
+    if (apu->triangle.length && !(apu->triangle.control & 0x80)) {
+        apu->triangle.length--;
+    }
+    if (apu->noise.length && !apu->noise.envelope.loop) {
+        apu->noise.length--;
+    }
+}
+
+static void clock_frame(nes_t *nes) {
+    nes_apu_t *apu = &nes->apu;
+    bool five = (apu->frame_mode & 0x80) != 0;
+    uint8_t last = five ? 4 : 3;
+    uint8_t step = apu->frame_step;
+    if (step != 3 || !five) {
+        clock_quarter(apu);
+        if (step == 1 || step == last) {
+            clock_half(apu);
+        }
+    }
+    if (!five && step == 3 && !(apu->frame_mode & 0x40)) {
+        apu->frame_irq = true;
+    }
+    if (step == last) {
+        apu->frame_start += five ? 37282u : 29830u;
+        step = 0;
+    } else {
+        step++;
+    }
+    apu->frame_step = step;
+    apu->frame_next = apu->frame_start + frame_positions[step];
+}
+
+static void catch_up(nes_t *nes, uint32_t until) {
+    nes_apu_t *apu = &nes->apu;
+    while (!before(until, apu->frame_next)) {
+        uint32_t time = apu->frame_next;
+        run_channels(nes, time);
+        clock_frame(nes);
+        if (nes->audio) {
+            mix(nes, time);
+        }
+    }
+    run_channels(nes, until);
+}
+
+/* The only APU events the CPU can observe without touching a register are
+ * the IRQs, so that is all the scheduler is asked to wake us for. While a
+ * sample plays the DMC buffer is refilled as soon as the shift register
+ * takes it, so its last fetch is a fixed number of output bits away. */
+static void schedule(nes_t *nes) {
+    nes_apu_t *apu = &nes->apu;
+    nes_dmc_t *dmc = &apu->dmc;
+    bool any = false;
+    uint32_t time = 0;
+    if (!(apu->frame_mode & 0xC0) && !apu->frame_irq) {
+        time = apu->frame_start + frame_positions[3];
+        any = true;
+    }
+    if ((dmc->control & 0xC0) == 0x80 && dmc->remaining && !apu->dmc_irq) {
+        uint32_t next = before(dmc->next, apu->time) ? apu->time : dmc->next;
+        uint32_t fetch = next + ((uint32_t)(dmc->bits - 1) + (uint32_t)(dmc->remaining - 1) * 8u) * dmc->period;
+        if (!any || before(fetch, time)) {
+            time = fetch;
+        }
+        any = true;
+    }
+    if (any) {
+        nes_sched_add(nes, NES_EVENT_APU, time);
+    } else {
+        nes_sched_cancel(nes, NES_EVENT_APU);
+    }
+}
+
+void nes_apu_reset(nes_t *nes) {
+    nes_apu_t *apu = &nes->apu;
+    uint32_t now = nes->sched.now;
+    memset(apu, 0, sizeof(*apu));
+    apu->noise.lfsr = 1;
+    apu->noise.period = noise_periods[0];
+    apu->dmc.period = dmc_periods[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+    apu->pulse[0].next = now;
+    apu->pulse[1].next = now;
+    apu->triangle.next = now;
+    apu->noise.next = now;
+    apu->dmc.next = now;
+    apu->frame_start = now;
+    apu->frame_next = now + FRAME_QUARTER;
+    apu->time = now;
+    schedule(nes);
+}
+
+static void write_envelope(nes_envelope_t *envelope, uint8_t value) {
+    envelope->loop = (value & 0x20) != 0;
+    envelope->constant = (value & 0x10) != 0;
+    envelope->volume = value & 0x0F;
+}
+
+static void write_pulse(nes_apu_t *apu, int channel, uint8_t reg, uint8_t value) {
+    nes_pulse_t *pulse = &apu->pulse[channel];
+    switch (reg) {
+    case 0:
+        pulse->duty = value >> 6;
+        write_envelope(&pulse->envelope, value);
+        break;
+    case 1:
+        pulse->sweep = value;
+        pulse->sweep_reload = true;
+        break;
+    case 2:
+        pulse->period = (uint16_t)((pulse->period & 0x700) | value);
+        break;
+    default:
+        pulse->period = (uint16_t)((pulse->period & 0xFF) | (value & 7) << 8);
+        if (apu->enabled & (1 << channel)) {
+            pulse->length = length_table[value >> 3];
+        }
+        pulse->step = 0;
+        pulse->envelope.start = true;
+        break;
+    }
+}
+
+void nes_apu_write(nes_t *nes, uint16_t addr, uint8_t value) {
+    nes_apu_t *apu = &nes->apu;
+    catch_up(nes, nes->sched.now);
+    switch (addr) {
+    case 0x4000:
+    case 0x4001:
+    case 0x4002:
+    case 0x4003:
+    case 0x4004:
+    case 0x4005:
+    case 0x4006:
+    case 0x4007:
+        write_pulse(apu, (addr >> 2) & 1, addr & 3, value);
+        break;
+    case 0x4008:
+        apu->triangle.control = value;
+        break;
+    case 0x400A:
+        apu->triangle.period = (uint16_t)((apu->triangle.period & 0x700) | value);
+        break;
+    case 0x400B:
+        apu->triangle.period = (uint16_t)((apu->triangle.period & 0xFF) | (value & 7) << 8);
+        if (apu->enabled & 0x04) {
+            apu->triangle.length = length_table[value >> 3];
+        }
+        apu->triangle.linear_reload = true;
+        break;
+    case 0x400C:
+        write_envelope(&apu->noise.envelope, value);
+        break;
+    case 0x400E:
+        apu->noise.mode = (value & 0x80) != 0;
+        apu->noise.period = noise_periods[value & 0x0F];
+        break;
+    case 0x400F:
+        if (apu->enabled & 0x08) {
+            apu->noise.length = length_table[value >> 3];
+        }
+        apu->noise.envelope.start = true;
+        break;
+    case 0x4010:
+        apu->dmc.control = value;
+        apu->dmc.period = dmc_periods[value & 0x0F];
+        if (!(value & 0x80)) {
+            apu->dmc_irq = false;
+        }
+        break;
+    case 0x4011:
+        apu->dmc.level = value & 0x7F;
+        break;
+    case 0x4012:
+        apu->dmc.sample_addr = (uint16_t)(0xC000 + value * 64);
+        break;
+    case 0x4013:
+        apu->dmc.sample_length = (uint16_t)(value * 16 + 1);
+        break;
+    case 0x4015:
+        apu->enabled = value & 0x1F;
+        if (!(value & 0x01)) {
+            apu->pulse[0].length = 0;
+        }
+        if (!(value & 0x02)) {
+            apu->pulse[1].length = 0;
+        }
+        if (!(value & 0x04)) {
+            apu->triangle.length = 0;
+        }
+        if (!(value & 0x08)) {
+            apu->noise.length = 0;
+        }
+        if (!(value & 0x10)) {
+            apu->dmc.remaining = 0;
+        } else if (!apu->dmc.remaining) {
+            dmc_restart(&apu->dmc);
+            dmc_fetch(nes);
+        }
+        apu->dmc_irq = false;
+        break;
+    case 0x4017:
+        apu->frame_mode = value;
+        if (value & 0x40) {
+            apu->frame_irq = false;
+        }
+        apu->frame_start = apu->time;
+        apu->frame_step = 0;
+        apu->frame_next = apu->time + FRAME_QUARTER;
+        if (value & 0x80) {
+            clock_quarter(apu);
+            clock_half(apu);
+        }
+        break;
+    default:
+        break;
+    }
+    if (nes->audio) {
+        mix(nes, apu->time);
+    }
+    schedule(nes);
+}
+
+/* Reading clears the frame IRQ flag. */
+uint8_t nes_apu_read_status(nes_t *nes) {
+    nes_apu_t *apu = &nes->apu;
+    catch_up(nes, nes->sched.now);
+    uint8_t status = (uint8_t)((apu->pulse[0].length ? 0x01 : 0) | (apu->pulse[1].length ? 0x02 : 0) |
+                               (apu->triangle.length ? 0x04 : 0) | (apu->noise.length ? 0x08 : 0) |
+                               (apu->dmc.remaining ? 0x10 : 0) | (apu->frame_irq ? 0x40 : 0) |
+                               (apu->dmc_irq ? 0x80 : 0));
+    if (apu->frame_irq) {
+        apu->frame_irq = false;
+        schedule(nes);
+    }
+    return status;
+}
+
+void nes_apu_event(nes_t *nes) {
+    catch_up(nes, nes->sched.now);
+    schedule(nes);
+}
+
+void nes_apu_buffer_init(nes_apu_buffer_t *buffer, uint32_t sample_rate) {
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->base_factor = (uint32_t)(((uint64_t)sample_rate << POS_BITS) / CPU_CLOCK);
+    buffer->factor = buffer->base_factor;
+}
+
+/* Output starts at the current time; channels that sat out while nothing
+ * was attached resume from here too. */
+void nes_apu_attach(nes_t *nes, nes_apu_buffer_t *buffer) {
+    catch_up(nes, nes->sched.now);
+    nes->audio = buffer;
+    if (buffer) {
+        buffer->base_time = nes->apu.time;
+        buffer->base_pos = 0;
+    }
+}
+
+/* Catches up to the current CPU time and returns how many finished samples
+ * the buffer holds, with end the position they run to. After a gap longer
+ * than MAX_CYCLES the buffer restarts empty. */
+static uint32_t pending_samples(nes_t *nes, nes_apu_buffer_t *buffer, uint32_t *end) {
+    catch_up(nes, nes->sched.now);
+    schedule(nes);
+    uint32_t cycles = nes->apu.time - buffer->base_time;
+    if (cycles > MAX_CYCLES) {
+        memset(buffer->deltas, 0, sizeof(buffer->deltas));
+        buffer->base_time = nes->apu.time;
+        buffer->base_pos = 0;
+        *end = 0;
+        return 0;
+    }
+    *end = cycles * buffer->factor + buffer->base_pos;
+    return *end >> POS_BITS;
+}
+
+/* Integrates the first count samples, into out unless it is NULL, shifts
+ * the rest of the buffer down once and rebases at the current APU time.
+ * Steps past the end of the buffer were never stored, so count may exceed
+ * it. The integrator leaks slightly, which removes the mixer's DC offset
+ * much like the console's own output filter. */
+static void consume(nes_t *nes, nes_apu_buffer_t *buffer, int16_t *out, uint32_t count, uint32_t end) {
+    const size_t size = NES_APU_BUFFER_SAMPLES + NES_APU_KERNEL_WIDTH;
+    size_t taken = count < size ? (size_t)count : size;
+    int32_t level = buffer->level;
+    if (out) {
+        for (size_t i = 0; i < taken; i++) {
+            level += buffer->deltas[i];
+            int32_t sample = level >> 15;
+            out[i] = (int16_t)(sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+            level -= level >> 10;
+        }
+    } else {
+        for (size_t i = 0; i < taken; i++) {
+            level += buffer->deltas[i];
+            level -= level >> 10;
+        }
+    }
+    buffer->level = level;
+    memmove(buffer->deltas, buffer->deltas + taken, (size - taken) * sizeof(buffer->deltas[0]));
+    memset(buffer->deltas + size - taken, 0, taken * sizeof(buffer->deltas[0]));
+    buffer->base_time = nes->apu.time;
+    buffer->base_pos = end - (count << POS_BITS);
+}
+
+/* Catches up to the current CPU time and returns up to count finished
+ * samples. */
+size_t nes_apu_read_samples(nes_t *nes, int16_t *out, size_t count) {
+    nes_apu_buffer_t *buffer = nes->audio;
+    if (!buffer) {
+        return 0;
+    }
+    uint32_t end;
+    uint32_t available = pending_samples(nes, buffer, &end);
+    if (available > NES_APU_BUFFER_SAMPLES) {
+        available = NES_APU_BUFFER_SAMPLES;
+    }
+    if (count > available) {
+        count = available;
+    }
+    /* size_t is 24 bits on the eZ80, so widen before shifting. */
+    consume(nes, buffer, out, (uint32_t)count, end);
+    return count;
+}
+
+/* Drops every finished sample in one pass, for when the consumer is full,
+ * and returns how many that was. The level still integrates them, so the
+ * output carries on without a step once there is room again. */
+uint32_t nes_apu_discard_samples(nes_t *nes) {
+    nes_apu_buffer_t *buffer = nes->audio;
+    if (!buffer) {
+        return 0;
+    }
+    uint32_t end;
+    uint32_t available = pending_samples(nes, buffer, &end);
+    consume(nes, buffer, NULL, available, end);
+    return available;
+}
+
+#endif
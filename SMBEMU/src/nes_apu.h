@@ -0,0 +1,44 @@
+#ifndef NES_APU_H
+#define NES_APU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nes.h"
+
+#define NES_APU_BUFFER_SAMPLES 2048
+#define NES_APU_KERNEL_WIDTH 8
+
+/* Band-limited output: mixer steps are added as deltas at fractional sample
+ * positions and integrated when read. factor is output samples per CPU
+ * cycle in 12.20 fixed point; rate control may move it off base_factor. */
+typedef struct nes_apu_buffer {
+    int32_t deltas[NES_APU_BUFFER_SAMPLES + NES_APU_KERNEL_WIDTH];
+    uint32_t factor;
+    uint32_t base_factor;
+    uint32_t base_time;
+    uint32_t base_pos;
+    int32_t level;
+} nes_apu_buffer_t;
+
+/* The APU compiles to stubs unless NES_APU is defined: register writes are
+ * dropped, $4015 reads 0 and no IRQ is raised, as before it existed. */
+#ifdef NES_APU
+void nes_apu_reset(nes_t *nes);
+void nes_apu_write(nes_t *nes, uint16_t addr, uint8_t value);
+uint8_t nes_apu_read_status(nes_t *nes);
+void nes_apu_event(nes_t *nes);
+void nes_apu_buffer_init(nes_apu_buffer_t *buffer, uint32_t sample_rate);
+void nes_apu_attach(nes_t *nes, nes_apu_buffer_t *buffer);
+size_t nes_apu_read_samples(nes_t *nes, int16_t *out, size_t count);
+uint32_t nes_apu_discard_samples(nes_t *nes);
+#define nes_apu_irq(nes) ((nes)->apu.frame_irq || (nes)->apu.dmc_irq)
+#else
+#define nes_apu_reset(nes) ((void)0)
+#define nes_apu_write(nes, addr, value) ((void)0)
+#define nes_apu_read_status(nes) ((uint8_t)0)
+#define nes_apu_event(nes) ((void)0)
+#define nes_apu_irq(nes) false
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef NES_ATOMIC_H
+#define NES_ATOMIC_H
+
+/* Counters shared between one producer and one consumer, plus an add that
+ * returns the previous value for reference counts. C11 builds get
+ * acquire/release ordering; the C99 fallback is only safe on a single core. */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_uint nes_atomic_t;
+#define nes_atomic_load(ptr) atomic_load_explicit((ptr), memory_order_acquire)
+#define nes_atomic_store(ptr, value) atomic_store_explicit((ptr), (value), memory_order_release)
+#define nes_atomic_add(ptr, value) atomic_fetch_add_explicit((ptr), (value), memory_order_acq_rel)
+#else
+typedef volatile unsigned int nes_atomic_t;
+#define nes_atomic_load(ptr) (*(ptr))
+#define nes_atomic_store(ptr, value) (*(ptr) = (value))
+#define nes_atomic_add(ptr, value) ((*(ptr) += (value)) - (value))
+#endif
+
+#endif
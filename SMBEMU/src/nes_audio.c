@@ -0,0 +1,131 @@
+#include "nes_audio.h"
+#include <string.h>
+
+#define RING_MASK (NES_AUDIO_RING_SIZE - 1)
+
+/* The resample ratio moves at most 1/RATE_RANGE away from nominal, 0.5%,
+ * which is well under a semitone and not audible as a pitch change. */
+#define RATE_RANGE 200
+
+void nes_audio_ring_init(nes_audio_ring_t *ring) {
+    nes_atomic_store(&ring->written, 0);
+    nes_atomic_store(&ring->read, 0);
+    ring->dropped = 0;
+    ring->underruns = 0;
+}
+
+size_t nes_audio_ring_fill(nes_audio_ring_t *ring) {
+    return (unsigned int)(nes_atomic_load(&ring->written) - nes_atomic_load(&ring->read));
+}
+
+/* Consumer side. Passes up to count samples to sink and counts a shortfall
+ * as an underrun; it is up to the backend to pad with silence. */
+size_t nes_audio_pump(nes_audio_ring_t *ring, nes_audio_sink_fn sink, void *ctx, size_t count) {
+    unsigned int read = nes_atomic_load(&ring->read);
+    size_t available = (unsigned int)(nes_atomic_load(&ring->written) - read);
+    if (count > available) {
+        ring->underruns++;
+        count = available;
+    }
+    size_t done = 0;
+    while (done < count) {
+        size_t index = (read + done) & RING_MASK;
+        size_t chunk = count - done;
+        if (chunk > NES_AUDIO_RING_SIZE - index) {
+            chunk = NES_AUDIO_RING_SIZE - index;
+        }
+        sink(ctx, ring->samples + index, chunk);
+        done += chunk;
+    }
+    nes_atomic_store(&ring->read, read + (unsigned int)count);
+    return count;
+}
+
+/* ctx is a uint32_t that counts the samples. */
+void nes_audio_null_sink(void *ctx, const int16_t *samples, size_t count) {
+    (void)samples;
+    *(uint32_t *)ctx += (uint32_t)count;
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, (uint16_t)value);
+    put16(p + 2, (uint16_t)(value >> 16));
+}
+
+/* bytes is the size of the sample data. Writers that cannot seek back to
+ * fix it up afterwards can pass the limit they will stop at. */
+void nes_audio_wav_header(uint8_t header[NES_AUDIO_WAV_HEADER_SIZE], uint32_t sample_rate, uint32_t bytes) {
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + bytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);
+    put16(header + 20, 1);
+    put16(header + 22, 1);
+    put32(header + 24, sample_rate);
+    put32(header + 28, sample_rate * 2);
+    put16(header + 32, 2);
+    put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, bytes);
+}
+
+/* Samples are written in memory order, which is what WAV wants on the
+ * little-endian eZ80 and x86 targets this builds for. */
+void nes_audio_wav_sink(void *ctx, const int16_t *samples, size_t count) {
+    nes_audio_wav_t *wav = ctx;
+    uint32_t size = (uint32_t)count * 2;
+    if (size > wav->limit - wav->bytes) {
+        size = (wav->limit - wav->bytes) & ~1u;
+    }
+    if (size) {
+        wav->write(wav->ctx, samples, size);
+        wav->bytes += size;
+    }
+}
+
+#ifdef NES_APU
+/* Producer side. Moves every finished APU sample into the ring, writing
+ * straight into its free space, and drops the ones that do not fit so the
+ * APU buffer never backs up. Never waits for the consumer. */
+size_t nes_audio_produce(nes_t *nes, nes_audio_ring_t *ring) {
+    unsigned int written = nes_atomic_load(&ring->written);
+    size_t space = NES_AUDIO_RING_SIZE - (unsigned int)(written - nes_atomic_load(&ring->read));
+    size_t produced = 0;
+    while (space) {
+        size_t index = (written + produced) & RING_MASK;
+        size_t chunk = space < NES_AUDIO_RING_SIZE - index ? space : NES_AUDIO_RING_SIZE - index;
+        size_t got = nes_apu_read_samples(nes, ring->samples + index, chunk);
+        produced += got;
+        space -= got;
+        if (got < chunk) {
+            break;
+        }
+    }
+    nes_atomic_store(&ring->written, written + (unsigned int)produced);
+    if (!space) {
+        ring->dropped += nes_apu_discard_samples(nes);
+    }
+    return produced;
+}
+
+/* Nudges the APU's output rate so the ring settles at target samples: a
+ * ring that is running dry gets samples slightly faster than nominal and a
+ * filling one slightly slower. Video pacing then never has to wait on the
+ * audio clock or the other way round. Call it straight after
+ * nes_audio_produce, while the APU buffer holds no pending steps. */
+void nes_audio_control_rate(nes_apu_buffer_t *buffer, nes_audio_ring_t *ring, size_t target) {
+    int32_t error = (int32_t)target - (int32_t)nes_audio_ring_fill(ring);
+    if (error > (int32_t)target) {
+        error = (int32_t)target;
+    } else if (error < -(int32_t)target) {
+        error = -(int32_t)target;
+    }
+    int32_t base = (int32_t)buffer->base_factor;
+    buffer->factor = (uint32_t)(base + base / RATE_RANGE * error / (int32_t)target);
+}
+#endif
@@ -0,0 +1,52 @@
+#ifndef NES_AUDIO_H
+#define NES_AUDIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "nes.h"
+#include "nes_apu.h"
+#include "nes_atomic.h"
+
+#define NES_AUDIO_RING_SIZE 4096
+#define NES_AUDIO_WAV_HEADER_SIZE 44
+
+/* Samples on their way from the emulation thread to an audio backend. There
+ * is one producer and one consumer and neither waits for the other: the
+ * producer drops what does not fit and the consumer takes what is there. */
+typedef struct {
+    int16_t samples[NES_AUDIO_RING_SIZE];
+    nes_atomic_t written;
+    nes_atomic_t read;
+    uint32_t dropped;
+    uint32_t underruns;
+} nes_audio_ring_t;
+
+/* A backend takes samples straight out of the ring, in up to two pieces
+ * when they wrap around its end. */
+typedef void (*nes_audio_sink_fn)(void *ctx, const int16_t *samples, size_t count);
+
+/* Receives the bytes of a WAV file as they are produced. */
+typedef void (*nes_audio_write_fn)(void *ctx, const void *data, size_t size);
+
+/* Mono 16-bit PCM, cut off after limit bytes of sample data. */
+typedef struct {
+    nes_audio_write_fn write;
+    void *ctx;
+    uint32_t bytes;
+    uint32_t limit;
+} nes_audio_wav_t;
+
+void nes_audio_ring_init(nes_audio_ring_t *ring);
+size_t nes_audio_ring_fill(nes_audio_ring_t *ring);
+size_t nes_audio_pump(nes_audio_ring_t *ring, nes_audio_sink_fn sink, void *ctx, size_t count);
+
+void nes_audio_null_sink(void *ctx, const int16_t *samples, size_t count);
+void nes_audio_wav_header(uint8_t header[NES_AUDIO_WAV_HEADER_SIZE], uint32_t sample_rate, uint32_t bytes);
+void nes_audio_wav_sink(void *ctx, const int16_t *samples, size_t count);
+
+#ifdef NES_APU
+size_t nes_audio_produce(nes_t *nes, nes_audio_ring_t *ring);
+void nes_audio_control_rate(nes_apu_buffer_t *buffer, nes_audio_ring_t *ring, size_t target);
+#endif
+
+#endif
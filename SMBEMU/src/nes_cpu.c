@@ -1,5 +1,16 @@
 #include "nes_cpu.h"
 #include "nes_mem.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_prof.h"
+#include "nes_trace.h"
+#include "nes_recomp.h"
+#include "nes_debug.h"
+#include "nes_perf.h"
+
+#if defined(NES_RECOMP) && (defined(NES_PROFILE) || defined(NES_TRACE))
+#error "RECOMP skips the per-instruction PROFILE and TRACE hooks; build them separately"
+#endif
 
 static uint8_t cpu_read(nes_t *nes, uint16_t addr) {
     return nes_cpu_read(nes, addr);
@@ -57,6 +68,7 @@ void nes_cpu_reset(nes_t *nes) {
 
 void nes_cpu_nmi(nes_t *nes) {
     nes_cpu_t *cpu = &nes->cpu;
+    NES_PERF_COUNT(nmis);
     push(nes, (cpu->pc >> 8) & 0xFF);
     push(nes, cpu->pc & 0xFF);
     push(nes, cpu->p & ~FLAG_B);
@@ -64,6 +76,15 @@ void nes_cpu_nmi(nes_t *nes) {
     cpu->pc = read16(nes, 0xFFFA);
 }
 
+void nes_cpu_irq(nes_t *nes) {
+    nes_cpu_t *cpu = &nes->cpu;
+    push(nes, (cpu->pc >> 8) & 0xFF);
+    push(nes, cpu->pc & 0xFF);
+    push(nes, cpu->p & ~FLAG_B);
+    cpu->p |= FLAG_I;
+    cpu->pc = read16(nes, 0xFFFE);
+}
+
 static void adc(nes_t *nes, uint8_t value) {
     nes_cpu_t *cpu = &nes->cpu;
     uint16_t sum = cpu->a + value + ((cpu->p & FLAG_C) ? 1 : 0);
@@ -137,21 +158,34 @@ static uint16_t addr_ind_y(nes_t *nes) {
     return ((uint16_t)hi << 8 | lo) + nes->cpu.y;
 }
 
-static void branch(nes_t *nes, bool condition) {
+/* Reads through abs,X, abs,Y and (zp),Y take a cycle more when adding the
+ * index carried into the high byte, which shows in the low byte of the
+ * result being below the index. */
+static int page_cross(uint16_t addr, uint8_t index) {
+    return (addr & 0xFF) < index;
+}
+
+/* A taken branch costs one cycle more, two if it lands on another page. */
+static int branch(nes_t *nes, bool condition) {
     int8_t offset = (int8_t)cpu_read(nes, nes->cpu.pc++);
-    if (condition) {
-        nes->cpu.pc = (uint16_t)(nes->cpu.pc + offset);
+    if (!condition) {
+        return 2;
     }
+    uint16_t from = nes->cpu.pc;
+    nes->cpu.pc = (uint16_t)(from + offset);
+    return ((from ^ nes->cpu.pc) & 0xFF00) ? 4 : 3;
 }
 
-int nes_cpu_step(nes_t *nes) {
-    nes_cpu_t *cpu = &nes->cpu;
-    if (cpu->nmi_pending) {
-        cpu->nmi_pending = false;
-        nes_cpu_nmi(nes);
-        return 7;
+/* Called after CLI, PLP and RTI. The inner loop of nes_cpu_run only checks
+ * its deadline, so an APU IRQ those just unmasked would otherwise wait for
+ * the next event; ending the slice now lets the outer loop take it. */
+static void unmask(nes_t *nes) {
+    if (nes_apu_irq(nes) && !(nes->cpu.p & FLAG_I)) {
+        nes->sched.deadline = nes->sched.now;
     }
-    uint8_t opcode = cpu_read(nes, cpu->pc++);
+}
+
+static int execute(nes_t *nes, nes_cpu_t *cpu, uint8_t opcode) {
     switch (opcode) {
     case 0x00: {
         cpu->pc++;
@@ -213,13 +247,12 @@ int nes_cpu_step(nes_t *nes) {
         return 6;
     }
     case 0x10:
-        branch(nes, (cpu->p & FLAG_N) == 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_N) == 0);
     case 0x11: {
         uint16_t addr = addr_ind_y(nes);
         cpu->a |= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0x15: {
         uint16_t addr = addr_zp_x(nes);
@@ -243,13 +276,13 @@ int nes_cpu_step(nes_t *nes) {
         uint16_t addr = addr_abs_y(nes);
         cpu->a |= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0x1D: {
         uint16_t addr = addr_abs_x(nes);
         cpu->a |= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0x1E: {
         uint16_t addr = addr_abs_x(nes);
@@ -302,6 +335,7 @@ int nes_cpu_step(nes_t *nes) {
     case 0x28:
         cpu->p = pop(nes);
         cpu->p |= FLAG_U;
+        unmask(nes);
         return 4;
     case 0x29: {
         uint8_t val = cpu_read(nes, addr_imm(nes));
@@ -342,13 +376,12 @@ int nes_cpu_step(nes_t *nes) {
         return 6;
     }
     case 0x30:
-        branch(nes, (cpu->p & FLAG_N) != 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_N) != 0);
     case 0x31: {
         uint16_t addr = addr_ind_y(nes);
         cpu->a &= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0x35: {
         uint16_t addr = addr_zp_x(nes);
@@ -373,13 +406,13 @@ int nes_cpu_step(nes_t *nes) {
         uint16_t addr = addr_abs_y(nes);
         cpu->a &= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0x3D: {
         uint16_t addr = addr_abs_x(nes);
         cpu->a &= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0x3E: {
         uint16_t addr = addr_abs_x(nes);
@@ -396,6 +429,7 @@ int nes_cpu_step(nes_t *nes) {
         cpu->p |= FLAG_U;
         cpu->pc = (uint16_t)pop(nes);
         cpu->pc |= (uint16_t)pop(nes) << 8;
+        unmask(nes);
         return 6;
     case 0x41: {
         uint16_t addr = addr_ind_x(nes);
@@ -451,13 +485,12 @@ int nes_cpu_step(nes_t *nes) {
         return 6;
     }
     case 0x50:
-        branch(nes, (cpu->p & FLAG_V) == 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_V) == 0);
     case 0x51: {
         uint16_t addr = addr_ind_y(nes);
         cpu->a ^= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0x55: {
         uint16_t addr = addr_zp_x(nes);
@@ -476,18 +509,19 @@ int nes_cpu_step(nes_t *nes) {
     }
     case 0x58:
         cpu->p &= ~FLAG_I;
+        unmask(nes);
         return 2;
     case 0x59: {
         uint16_t addr = addr_abs_y(nes);
         cpu->a ^= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0x5D: {
         uint16_t addr = addr_abs_x(nes);
         cpu->a ^= cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0x5E: {
         uint16_t addr = addr_abs_x(nes);
@@ -556,12 +590,11 @@ int nes_cpu_step(nes_t *nes) {
         return 6;
     }
     case 0x70:
-        branch(nes, (cpu->p & FLAG_V) != 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_V) != 0);
     case 0x71: {
         uint16_t addr = addr_ind_y(nes);
         adc(nes, cpu_read(nes, addr));
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0x75: {
         uint16_t addr = addr_zp_x(nes);
@@ -584,12 +617,12 @@ int nes_cpu_step(nes_t *nes) {
     case 0x79: {
         uint16_t addr = addr_abs_y(nes);
         adc(nes, cpu_read(nes, addr));
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0x7D: {
         uint16_t addr = addr_abs_x(nes);
         adc(nes, cpu_read(nes, addr));
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0x7E: {
         uint16_t addr = addr_abs_x(nes);
@@ -645,8 +678,7 @@ int nes_cpu_step(nes_t *nes) {
         return 4;
     }
     case 0x90:
-        branch(nes, (cpu->p & FLAG_C) == 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_C) == 0);
     case 0x91: {
         uint16_t addr = addr_ind_y(nes);
         cpu_write(nes, addr, cpu->a);
@@ -747,13 +779,12 @@ int nes_cpu_step(nes_t *nes) {
         return 4;
     }
     case 0xB0:
-        branch(nes, (cpu->p & FLAG_C) != 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_C) != 0);
     case 0xB1: {
         uint16_t addr = addr_ind_y(nes);
         cpu->a = cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0xB4: {
         uint16_t addr = addr_zp_x(nes);
@@ -780,7 +811,7 @@ int nes_cpu_step(nes_t *nes) {
         uint16_t addr = addr_abs_y(nes);
         cpu->a = cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0xBA:
         cpu->x = cpu->sp;
@@ -790,19 +821,19 @@ int nes_cpu_step(nes_t *nes) {
         uint16_t addr = addr_abs_x(nes);
         cpu->y = cpu_read(nes, addr);
         set_zn(cpu, cpu->y);
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0xBD: {
         uint16_t addr = addr_abs_x(nes);
         cpu->a = cpu_read(nes, addr);
         set_zn(cpu, cpu->a);
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0xBE: {
         uint16_t addr = addr_abs_y(nes);
         cpu->x = cpu_read(nes, addr);
         set_zn(cpu, cpu->x);
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0xC0:
         {
@@ -896,8 +927,7 @@ int nes_cpu_step(nes_t *nes) {
         return 6;
     }
     case 0xD0:
-        branch(nes, (cpu->p & FLAG_Z) == 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_Z) == 0);
     case 0xD1: {
         uint16_t addr = addr_ind_y(nes);
         uint8_t val = cpu_read(nes, addr);
@@ -906,7 +936,7 @@ int nes_cpu_step(nes_t *nes) {
                  ((cpu->a >= val) ? FLAG_C : 0) |
                  ((res == 0) ? FLAG_Z : 0) |
                  ((res & 0x80) ? FLAG_N : 0);
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0xD5: {
         uint16_t addr = addr_zp_x(nes);
@@ -936,7 +966,7 @@ int nes_cpu_step(nes_t *nes) {
                  ((cpu->a >= val) ? FLAG_C : 0) |
                  ((res == 0) ? FLAG_Z : 0) |
                  ((res & 0x80) ? FLAG_N : 0);
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0xDD: {
         uint16_t addr = addr_abs_x(nes);
@@ -946,7 +976,7 @@ int nes_cpu_step(nes_t *nes) {
                  ((cpu->a >= val) ? FLAG_C : 0) |
                  ((res == 0) ? FLAG_Z : 0) |
                  ((res & 0x80) ? FLAG_N : 0);
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0xDE: {
         uint16_t addr = addr_abs_x(nes);
@@ -1023,12 +1053,11 @@ int nes_cpu_step(nes_t *nes) {
         return 6;
     }
     case 0xF0:
-        branch(nes, (cpu->p & FLAG_Z) != 0);
-        return 2;
+        return branch(nes, (cpu->p & FLAG_Z) != 0);
     case 0xF1: {
         uint16_t addr = addr_ind_y(nes);
         sbc(nes, cpu_read(nes, addr));
-        return 5;
+        return 5 + page_cross(addr, cpu->y);
     }
     case 0xF5: {
         uint16_t addr = addr_zp_x(nes);
@@ -1048,12 +1077,12 @@ int nes_cpu_step(nes_t *nes) {
     case 0xF9: {
         uint16_t addr = addr_abs_y(nes);
         sbc(nes, cpu_read(nes, addr));
-        return 4;
+        return 4 + page_cross(addr, cpu->y);
     }
     case 0xFD: {
         uint16_t addr = addr_abs_x(nes);
         sbc(nes, cpu_read(nes, addr));
-        return 4;
+        return 4 + page_cross(addr, cpu->x);
     }
     case 0xFE: {
         uint16_t addr = addr_abs_x(nes);
@@ -1063,6 +1092,107 @@ int nes_cpu_step(nes_t *nes) {
         return 7;
     }
     default:
+        NES_TRACE_UNKNOWN(cpu->pc - 1, opcode);
         return 2;
     }
 }
+
+#if defined(NES_PROFILE) || defined(NES_TRACE) || defined(NES_PERF)
+static int fetch_execute(nes_t *nes, nes_cpu_t *cpu) {
+    uint16_t pc = cpu->pc;
+    NES_TRACE_INSN(nes);
+    uint8_t opcode = cpu_read(nes, cpu->pc++);
+    int cycles = execute(nes, cpu, opcode);
+    NES_PROF_INSN(pc, opcode, cycles);
+    NES_PERF_COUNT(instructions);
+    (void)pc;
+    return cycles;
+}
+#define FETCH_EXECUTE(nes, cpu) fetch_execute((nes), (cpu))
+#else
+#define FETCH_EXECUTE(nes, cpu) execute((nes), (cpu), cpu_read((nes), (cpu)->pc++))
+#endif
+
+int nes_cpu_step(nes_t *nes) {
+    nes_cpu_t *cpu = &nes->cpu;
+    if (cpu->nmi_pending) {
+        cpu->nmi_pending = false;
+        nes_cpu_nmi(nes);
+        return 7;
+    }
+    if (nes_apu_irq(nes) && !(cpu->p & FLAG_I)) {
+        nes_cpu_irq(nes);
+        return 7;
+    }
+    return FETCH_EXECUTE(nes, cpu);
+}
+
+#ifdef NES_DEBUG
+/* The checked counterpart of the inner loop in nes_cpu_run, used only while
+ * a breakpoint, watchpoint or trace is set. Returns false when one hit; the
+ * PC is then at the breakpoint, or past the instruction that made the
+ * watched access. Recompiled blocks are not used here. */
+static bool debug_run(nes_t *nes) {
+    nes_cpu_t *cpu = &nes->cpu;
+    nes_sched_t *sched = &nes->sched;
+    while ((int32_t)(sched->now - sched->deadline) < 0) {
+        if (!nes_debug_step(nes)) {
+            return false;
+        }
+        int cycles = FETCH_EXECUTE(nes, cpu);
+        sched->now += (uint32_t)cycles;
+        if (nes_debug.hit) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+/* Runs until cycle_budget more cycles have elapsed on the scheduler clock.
+ * Interrupt and PPU state only change at scheduled events, so the inner loop
+ * checks nothing but its deadline. Overshoot is carried into the next call.
+ * An APU IRQ left pending behind the I flag is taken as soon as CLI, PLP or
+ * RTI clears it, since those end the slice (see unmask).
+ * A debugger hit returns early; the rest of the budget runs on the next
+ * call. */
+uint32_t nes_cpu_run(nes_t *nes, uint32_t cycle_budget) {
+    nes_cpu_t *cpu = &nes->cpu;
+    nes_sched_t *sched = &nes->sched;
+    uint32_t start = sched->now;
+    uint32_t target = sched->target + cycle_budget;
+    sched->target = target;
+    while ((int32_t)(sched->now - target) < 0) {
+        if (cpu->nmi_pending) {
+            cpu->nmi_pending = false;
+            nes_cpu_nmi(nes);
+            sched->now += 7;
+        } else if (nes_apu_irq(nes) && !(cpu->p & FLAG_I)) {
+            nes_cpu_irq(nes);
+            sched->now += 7;
+        }
+        sched->deadline = nes_sched_deadline(nes, target);
+#ifdef NES_DEBUG
+        if (nes_debug.active && !debug_run(nes)) {
+            break;
+        }
+#endif
+        while ((int32_t)(sched->now - sched->deadline) < 0) {
+#ifdef NES_RECOMP
+            nes_block_fn block = nes_recomp_lookup(cpu->pc);
+            if (block) {
+                NES_PERF_COUNT(blocks);
+                block(nes, sched->deadline);
+                continue;
+            }
+#endif
+            /* A $4014 write adds the DMA cycles to sched->now inside the
+             * call, so it must be read again after the call returns. */
+            int cycles = FETCH_EXECUTE(nes, cpu);
+            sched->now += (uint32_t)cycles;
+        }
+        nes_sched_dispatch(nes);
+    }
+    NES_PERF_ADD(cycles, sched->now - start);
+    return sched->now - start;
+}
@@ -6,6 +6,8 @@
 
 void nes_cpu_reset(nes_t *nes);
 int nes_cpu_step(nes_t *nes);
+uint32_t nes_cpu_run(nes_t *nes, uint32_t cycle_budget);
 void nes_cpu_nmi(nes_t *nes);
+void nes_cpu_irq(nes_t *nes);
 
 #endif
@@ -0,0 +1,260 @@
+#include "nes_debug.h"
+
+#ifdef NES_DEBUG
+
+#include <stdio.h>
+#include <string.h>
+#include "nes_opcodes.h"
+
+nes_debug_t nes_debug;
+
+static void update_active(void) {
+    nes_debug.active = nes_debug.breakpoints || nes_debug.watch_count || nes_debug.tracing;
+}
+
+void nes_debug_reset(void) {
+    memset(&nes_debug, 0, sizeof(nes_debug));
+}
+
+bool nes_debug_break(uint16_t pc) {
+    uint8_t bit = (uint8_t)(1 << (pc & 7));
+    if (!(nes_debug.pc_bits[pc >> 3] & bit)) {
+        nes_debug.pc_bits[pc >> 3] |= bit;
+        nes_debug.breakpoints++;
+    }
+    update_active();
+    return true;
+}
+
+/* Watches start to end inclusive for reads, writes or both. */
+bool nes_debug_watch(uint16_t start, uint16_t end, uint8_t kinds) {
+    if (nes_debug.watch_count >= NES_DEBUG_MAX_WATCHES || end < start || !kinds) {
+        return false;
+    }
+    nes_debug_watch_t *watch = &nes_debug.watches[nes_debug.watch_count++];
+    watch->start = start;
+    watch->end = end;
+    watch->kinds = kinds;
+    for (unsigned int page = start >> 8; page <= (unsigned int)(end >> 8); page++) {
+        nes_debug.slow_pages[page] |= kinds;
+    }
+    update_active();
+    return true;
+}
+
+void nes_debug_trace(bool enabled) {
+    nes_debug.tracing = enabled;
+    update_active();
+}
+
+/* Slow path for accesses to a flagged page: only the first hit of an
+ * instruction is kept. */
+void nes_debug_bus(const nes_t *nes, uint16_t addr, uint8_t value, bool write) {
+    uint8_t kind = write ? NES_DEBUG_WRITE : NES_DEBUG_READ;
+    if (nes_debug.hit) {
+        return;
+    }
+    for (uint8_t i = 0; i < nes_debug.watch_count; i++) {
+        const nes_debug_watch_t *watch = &nes_debug.watches[i];
+        if ((watch->kinds & kind) && addr >= watch->start && addr <= watch->end) {
+            nes_debug.hit = write ? NES_DEBUG_HIT_WRITE : NES_DEBUG_HIT_READ;
+            nes_debug.hit_addr = addr;
+            nes_debug.hit_value = value;
+            nes_debug.hit_pc = nes_debug.insn_pc;
+            nes_debug.hit_cycle = nes->sched.now;
+            return;
+        }
+    }
+}
+
+/* Opcodes are fetched for the trace without going through the bus, so
+ * tracing neither trips watchpoints nor touches registers. */
+static uint8_t peek(const nes_t *nes, uint16_t addr) {
+    if (addr >= 0x8000) {
+        return nes->prg[addr - 0x8000];
+    }
+    return addr < 0x2000 ? nes->ram[addr & 0x7FF] : 0;
+}
+
+/* Called before each instruction. Returns false at a breakpoint, except
+ * for the one just resumed from. */
+bool nes_debug_step(const nes_t *nes) {
+    const nes_cpu_t *cpu = &nes->cpu;
+    uint16_t pc = cpu->pc;
+    if ((nes_debug.pc_bits[pc >> 3] >> (pc & 7)) & 1) {
+        if (!nes_debug.resuming || pc != nes_debug.resume_pc) {
+            nes_debug.hit = NES_DEBUG_HIT_BREAK;
+            nes_debug.hit_addr = pc;
+            nes_debug.hit_value = 0;
+            nes_debug.hit_pc = pc;
+            nes_debug.hit_cycle = nes->sched.now;
+            return false;
+        }
+    }
+    nes_debug.resuming = false;
+    nes_debug.insn_pc = pc;
+    if (nes_debug.tracing) {
+        nes_debug_record_t *record = &nes_debug.ring[nes_debug.ring_head];
+        record->pc = pc;
+        record->opcode = peek(nes, pc);
+        record->a = cpu->a;
+        record->x = cpu->x;
+        record->y = cpu->y;
+        record->p = cpu->p;
+        record->sp = cpu->sp;
+        record->cycle = nes->sched.now;
+        nes_debug.ring_head = (uint16_t)((nes_debug.ring_head + 1) % NES_DEBUG_TRACE_SIZE);
+        if (nes_debug.ring_count < NES_DEBUG_TRACE_SIZE) {
+            nes_debug.ring_count++;
+        }
+    }
+    return true;
+}
+
+void nes_debug_resume(void) {
+    nes_debug.resuming = nes_debug.hit == NES_DEBUG_HIT_BREAK;
+    nes_debug.resume_pc = nes_debug.hit_pc;
+    nes_debug.hit = NES_DEBUG_HIT_NONE;
+}
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static const char *read_word(const char *p, const char *end, char *word, size_t size) {
+    size_t length = 0;
+    p = skip_space(p, end);
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        if (length + 1 < size) {
+            word[length++] = *p;
+        }
+        p++;
+    }
+    word[length] = '\0';
+    return p;
+}
+
+static bool parse_hex(const char *text, uint16_t *value) {
+    uint32_t result = 0;
+    if (*text == '$') {
+        text++;
+    }
+    if (!*text) {
+        return false;
+    }
+    for (; *text; text++) {
+        char c = *text;
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+                    c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0 || result > 0xFFF) {
+            return false;
+        }
+        result = result << 4 | (uint32_t)digit;
+    }
+    *value = (uint16_t)result;
+    return true;
+}
+
+/* "ADDR" or "START-END". */
+static bool parse_range(char *text, uint16_t *start, uint16_t *end) {
+    char *dash = strchr(text, '-');
+    if (!dash) {
+        return parse_hex(text, start) && (*end = *start, true);
+    }
+    *dash = '\0';
+    return parse_hex(text, start) && parse_hex(dash + 1, end);
+}
+
+/* One command per line, addresses in hex with or without $:
+ *
+ *   break ADDR           stop before the instruction at ADDR
+ *   read RANGE           stop after an instruction reads from RANGE
+ *   write RANGE          stop after an instruction writes to RANGE
+ *   watch RANGE          both of the above
+ *   trace                keep the last NES_DEBUG_TRACE_SIZE instructions
+ *
+ * RANGE is ADDR or START-END; # starts a comment. */
+bool nes_debug_load(const char *text, size_t size, const char **error) {
+    const char *p = text;
+    const char *end = text + size;
+    *error = NULL;
+    while (p < end) {
+        char command[8];
+        char argument[16];
+        uint16_t start;
+        uint16_t last;
+        p = read_word(p, end, command, sizeof(command));
+        p = read_word(p, end, argument, sizeof(argument));
+        bool ok = true;
+        if (!command[0] || command[0] == '#') {
+        } else if (!strcmp(command, "break")) {
+            ok = parse_hex(argument, &start) && nes_debug_break(start);
+        } else if (!strcmp(command, "read")) {
+            ok = parse_range(argument, &start, &last) && nes_debug_watch(start, last, NES_DEBUG_READ);
+        } else if (!strcmp(command, "write")) {
+            ok = parse_range(argument, &start, &last) && nes_debug_watch(start, last, NES_DEBUG_WRITE);
+        } else if (!strcmp(command, "watch")) {
+            ok = parse_range(argument, &start, &last) &&
+                 nes_debug_watch(start, last, NES_DEBUG_READ | NES_DEBUG_WRITE);
+        } else if (!strcmp(command, "trace")) {
+            nes_debug_trace(true);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            *error = "Bad line in SMBDBG";
+            return false;
+        }
+        while (p < end && *p++ != '\n') {
+        }
+    }
+    return true;
+}
+
+static void format_record(const nes_debug_record_t *record, char *line, size_t size) {
+    snprintf(line, size, "%04X %s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lu", (unsigned int)record->pc,
+             nes_opcode_names[record->opcode], (unsigned int)record->a, (unsigned int)record->x,
+             (unsigned int)record->y, (unsigned int)record->p, (unsigned int)record->sp,
+             (unsigned long)record->cycle);
+}
+
+/* The hit, the registers now, then the trace ring oldest first. */
+void nes_debug_report(const nes_t *nes, nes_report_fn emit, void *ctx) {
+    const nes_cpu_t *cpu = &nes->cpu;
+    char line[80];
+    switch (nes_debug.hit) {
+    case NES_DEBUG_HIT_BREAK:
+        snprintf(line, sizeof(line), "break %04X CYC:%lu", (unsigned int)nes_debug.hit_addr,
+                 (unsigned long)nes_debug.hit_cycle);
+        break;
+    case NES_DEBUG_HIT_READ:
+        snprintf(line, sizeof(line), "read %04X by %04X CYC:%lu", (unsigned int)nes_debug.hit_addr,
+                 (unsigned int)nes_debug.hit_pc, (unsigned long)nes_debug.hit_cycle);
+        break;
+    case NES_DEBUG_HIT_WRITE:
+        snprintf(line, sizeof(line), "write %04X=%02X by %04X CYC:%lu", (unsigned int)nes_debug.hit_addr,
+                 (unsigned int)nes_debug.hit_value, (unsigned int)nes_debug.hit_pc,
+                 (unsigned long)nes_debug.hit_cycle);
+        break;
+    default:
+        snprintf(line, sizeof(line), "no hit");
+        break;
+    }
+    emit(ctx, line);
+    snprintf(line, sizeof(line), "PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X", (unsigned int)cpu->pc,
+             (unsigned int)cpu->a, (unsigned int)cpu->x, (unsigned int)cpu->y, (unsigned int)cpu->p,
+             (unsigned int)cpu->sp);
+    emit(ctx, line);
+    uint16_t index = (uint16_t)((nes_debug.ring_head + NES_DEBUG_TRACE_SIZE - nes_debug.ring_count) %
+                                NES_DEBUG_TRACE_SIZE);
+    for (uint16_t i = 0; i < nes_debug.ring_count; i++) {
+        format_record(&nes_debug.ring[index], line, sizeof(line));
+        emit(ctx, line);
+        index = (uint16_t)((index + 1) % NES_DEBUG_TRACE_SIZE);
+    }
+}
+
+#endif
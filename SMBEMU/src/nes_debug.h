@@ -0,0 +1,90 @@
+#ifndef NES_DEBUG_H
+#define NES_DEBUG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nes.h"
+#include "nes_prof.h"
+
+#define NES_DEBUG_MAX_WATCHES 16
+#define NES_DEBUG_TRACE_SIZE 256
+
+#define NES_DEBUG_READ 0x01
+#define NES_DEBUG_WRITE 0x02
+
+typedef enum {
+    NES_DEBUG_HIT_NONE,
+    NES_DEBUG_HIT_BREAK,
+    NES_DEBUG_HIT_READ,
+    NES_DEBUG_HIT_WRITE
+} nes_debug_hit_t;
+
+/* One executed instruction, as it was before it ran. */
+typedef struct {
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t sp;
+    uint32_t cycle;
+} nes_debug_record_t;
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+    uint8_t kinds;
+} nes_debug_watch_t;
+
+/* Breakpoints are a bitmap over the whole address space, and watchpoints
+ * mark the 256-byte pages they touch as slow. While neither is set and
+ * tracing is off, active is false and nes_cpu_run takes its usual loop;
+ * the only cost left is one page flag test per bus access. */
+typedef struct {
+    bool active;
+    bool tracing;
+    uint16_t breakpoints;
+    uint8_t pc_bits[0x10000 / 8];
+    uint8_t slow_pages[256];
+    nes_debug_watch_t watches[NES_DEBUG_MAX_WATCHES];
+    uint8_t watch_count;
+    uint16_t insn_pc;
+    uint16_t resume_pc;
+    bool resuming;
+    nes_debug_record_t ring[NES_DEBUG_TRACE_SIZE];
+    uint16_t ring_head;
+    uint16_t ring_count;
+    uint8_t hit;
+    uint16_t hit_addr;
+    uint8_t hit_value;
+    uint16_t hit_pc;
+    uint32_t hit_cycle;
+} nes_debug_t;
+
+/* The debugger compiles to nothing unless NES_DEBUG is defined. */
+#ifdef NES_DEBUG
+extern nes_debug_t nes_debug;
+
+void nes_debug_reset(void);
+bool nes_debug_break(uint16_t pc);
+bool nes_debug_watch(uint16_t start, uint16_t end, uint8_t kinds);
+void nes_debug_trace(bool enabled);
+bool nes_debug_load(const char *text, size_t size, const char **error);
+void nes_debug_bus(const nes_t *nes, uint16_t addr, uint8_t value, bool write);
+bool nes_debug_step(const nes_t *nes);
+void nes_debug_resume(void);
+void nes_debug_report(const nes_t *nes, nes_report_fn emit, void *ctx);
+#define NES_DEBUG_BUS(nes, addr, value, write)                                  \
+    do {                                                                        \
+        uint8_t debug_kind_ = (write) ? NES_DEBUG_WRITE : NES_DEBUG_READ;       \
+        if (nes_debug.slow_pages[(addr) >> 8] & debug_kind_) {                  \
+            nes_debug_bus((nes), (addr), (value), (write));                     \
+        }                                                                       \
+    } while (0)
+#else
+#define NES_DEBUG_BUS(nes, addr, value, write) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include "nes_diff.h"
+
+#ifdef NES_DIFF
+
+#include <stdio.h>
+#include <string.h>
+#include "nes_cpu.h"
+#include "nes_mem.h"
+#include "nes_sched.h"
+#include "nes_recomp.h"
+
+static uint32_t next_random(uint32_t *seed) {
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+/* nes_cpu_step plus the scheduler bookkeeping nes_cpu_run does inline, so
+ * the two can be compared instruction by instruction. */
+int nes_diff_reference_step(nes_t *nes) {
+    int cycles = nes_cpu_step(nes);
+    nes->sched.now += (uint32_t)cycles;
+    nes->sched.target = nes->sched.now;
+    nes_sched_dispatch(nes);
+    return cycles;
+}
+
+int nes_diff_run_step(nes_t *nes) {
+    nes->sched.target = nes->sched.now;
+    return (int)nes_cpu_run(nes, 1);
+}
+
+static bool differs(nes_diff_t *diff, const char *field, uint16_t offset, uint32_t expected, uint32_t actual) {
+    if (expected == actual) {
+        return false;
+    }
+    diff->field = field;
+    diff->offset = offset;
+    diff->expected = expected;
+    diff->actual = actual;
+    return true;
+}
+
+static bool differs_bytes(nes_diff_t *diff, const char *field, const uint8_t *expected, const uint8_t *actual, uint16_t size) {
+    for (uint16_t i = 0; i < size; i++) {
+        if (differs(diff, field, i, expected[i], actual[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool differs_envelope(nes_diff_t *diff, uint16_t channel, const nes_envelope_t *r, const nes_envelope_t *t) {
+    return differs(diff, "apu.envelope.volume", channel, r->volume, t->volume) ||
+           differs(diff, "apu.envelope.decay", channel, r->decay, t->decay) ||
+           differs(diff, "apu.envelope.divider", channel, r->divider, t->divider) ||
+           differs(diff, "apu.envelope.start", channel, r->start, t->start) ||
+           differs(diff, "apu.envelope.constant", channel, r->constant, t->constant) ||
+           differs(diff, "apu.envelope.loop", channel, r->loop, t->loop);
+}
+
+/* Channel state field by field. Envelopes report their channel as the
+ * offset: 0 and 1 for the pulses, 3 for noise. */
+static bool differs_apu(nes_diff_t *diff, const nes_apu_t *r, const nes_apu_t *t) {
+    for (uint16_t i = 0; i < 2; i++) {
+        const nes_pulse_t *rp = &r->pulse[i];
+        const nes_pulse_t *tp = &t->pulse[i];
+        if (differs_envelope(diff, i, &rp->envelope, &tp->envelope) ||
+            differs(diff, "apu.pulse.duty", i, rp->duty, tp->duty) ||
+            differs(diff, "apu.pulse.step", i, rp->step, tp->step) ||
+            differs(diff, "apu.pulse.length", i, rp->length, tp->length) ||
+            differs(diff, "apu.pulse.period", i, rp->period, tp->period) ||
+            differs(diff, "apu.pulse.next", i, rp->next, tp->next) ||
+            differs(diff, "apu.pulse.sweep", i, rp->sweep, tp->sweep) ||
+            differs(diff, "apu.pulse.sweep_divider", i, rp->sweep_divider, tp->sweep_divider) ||
+            differs(diff, "apu.pulse.sweep_reload", i, rp->sweep_reload, tp->sweep_reload)) {
+            return true;
+        }
+    }
+    const nes_triangle_t *rt = &r->triangle;
+    const nes_triangle_t *tt = &t->triangle;
+    const nes_noise_t *rn = &r->noise;
+    const nes_noise_t *tn = &t->noise;
+    const nes_dmc_t *rd = &r->dmc;
+    const nes_dmc_t *td = &t->dmc;
+    return differs(diff, "apu.triangle.control", 0, rt->control, tt->control) ||
+           differs(diff, "apu.triangle.linear", 0, rt->linear, tt->linear) ||
+           differs(diff, "apu.triangle.linear_reload", 0, rt->linear_reload, tt->linear_reload) ||
+           differs(diff, "apu.triangle.length", 0, rt->length, tt->length) ||
+           differs(diff, "apu.triangle.step", 0, rt->step, tt->step) ||
+           differs(diff, "apu.triangle.period", 0, rt->period, tt->period) ||
+           differs(diff, "apu.triangle.next", 0, rt->next, tt->next) ||
+           differs_envelope(diff, 3, &rn->envelope, &tn->envelope) ||
+           differs(diff, "apu.noise.length", 0, rn->length, tn->length) ||
+           differs(diff, "apu.noise.mode", 0, rn->mode, tn->mode) ||
+           differs(diff, "apu.noise.period", 0, rn->period, tn->period) ||
+           differs(diff, "apu.noise.lfsr", 0, rn->lfsr, tn->lfsr) ||
+           differs(diff, "apu.noise.next", 0, rn->next, tn->next) ||
+           differs(diff, "apu.dmc.control", 0, rd->control, td->control) ||
+           differs(diff, "apu.dmc.level", 0, rd->level, td->level) ||
+           differs(diff, "apu.dmc.sample_addr", 0, rd->sample_addr, td->sample_addr) ||
+           differs(diff, "apu.dmc.sample_length", 0, rd->sample_length, td->sample_length) ||
+           differs(diff, "apu.dmc.addr", 0, rd->addr, td->addr) ||
+           differs(diff, "apu.dmc.remaining", 0, rd->remaining, td->remaining) ||
+           differs(diff, "apu.dmc.buffer", 0, rd->buffer, td->buffer) ||
+           differs(diff, "apu.dmc.buffer_full", 0, rd->buffer_full, td->buffer_full) ||
+           differs(diff, "apu.dmc.shift", 0, rd->shift, td->shift) ||
+           differs(diff, "apu.dmc.bits", 0, rd->bits, td->bits) ||
+           differs(diff, "apu.dmc.silence", 0, rd->silence, td->silence) ||
+           differs(diff, "apu.dmc.period", 0, rd->period, td->period) ||
+           differs(diff, "apu.dmc.next", 0, rd->next, td->next) ||
+           differs(diff, "apu.enabled", 0, r->enabled, t->enabled) ||
+           differs(diff, "apu.frame_mode", 0, r->frame_mode, t->frame_mode) ||
+           differs(diff, "apu.frame_step", 0, r->frame_step, t->frame_step) ||
+           differs(diff, "apu.frame_start", 0, r->frame_start, t->frame_start) ||
+           differs(diff, "apu.frame_next", 0, r->frame_next, t->frame_next) ||
+           differs(diff, "apu.frame_irq", 0, r->frame_irq, t->frame_irq) ||
+           differs(diff, "apu.dmc_irq", 0, r->dmc_irq, t->dmc_irq) ||
+           differs(diff, "apu.time", 0, r->time, t->time) ||
+           differs(diff, "apu.mix", 0, (uint32_t)r->mix, (uint32_t)t->mix);
+}
+
+/* The pending events, in order. target and deadline only bound the current
+ * nes_cpu_run call and differ between the two step functions by design. */
+static bool differs_events(nes_diff_t *diff, const nes_sched_t *r, const nes_sched_t *t) {
+    if (differs(diff, "sched.count", 0, r->count, t->count)) {
+        return true;
+    }
+    for (uint16_t i = 0; i < r->count; i++) {
+        if (differs(diff, "sched.kind", i, r->events[i].kind, t->events[i].kind) ||
+            differs(diff, "sched.time", i, r->events[i].time, t->events[i].time)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Compares all emulated state; host-side pointers are not part of it. */
+bool nes_diff_compare(const nes_t *ref, const nes_t *test, nes_diff_t *diff) {
+    const nes_cpu_t *rc = &ref->cpu;
+    const nes_cpu_t *tc = &test->cpu;
+    const nes_ppu_t *rp = &ref->ppu;
+    const nes_ppu_t *tp = &test->ppu;
+    return differs(diff, "pc", 0, rc->pc, tc->pc) ||
+           differs(diff, "a", 0, rc->a, tc->a) ||
+           differs(diff, "x", 0, rc->x, tc->x) ||
+           differs(diff, "y", 0, rc->y, tc->y) ||
+           differs(diff, "p", 0, rc->p, tc->p) ||
+           differs(diff, "sp", 0, rc->sp, tc->sp) ||
+           differs(diff, "nmi", 0, rc->nmi_pending, tc->nmi_pending) ||
+           differs(diff, "cycles", 0, ref->sched.now, test->sched.now) ||
+           differs_events(diff, &ref->sched, &test->sched) ||
+           differs_bytes(diff, "ram", ref->ram, test->ram, NES_RAM_SIZE) ||
+           differs(diff, "ppu.ctrl", 0, rp->ctrl, tp->ctrl) ||
+           differs(diff, "ppu.mask", 0, rp->mask, tp->mask) ||
+           differs(diff, "ppu.status", 0, rp->status, tp->status) ||
+           differs(diff, "ppu.oam_addr", 0, rp->oam_addr, tp->oam_addr) ||
+           differs(diff, "ppu.vram_addr", 0, rp->vram_addr, tp->vram_addr) ||
+           differs(diff, "ppu.temp_addr", 0, rp->temp_addr, tp->temp_addr) ||
+           differs(diff, "ppu.fine_x", 0, rp->fine_x, tp->fine_x) ||
+           differs(diff, "ppu.addr_latch", 0, rp->addr_latch, tp->addr_latch) ||
+           differs(diff, "ppu.scroll_x", 0, rp->scroll_x, tp->scroll_x) ||
+           differs(diff, "ppu.scroll_y", 0, rp->scroll_y, tp->scroll_y) ||
+           differs(diff, "ppu.data_buffer", 0, rp->data_buffer, tp->data_buffer) ||
+           differs_bytes(diff, "ppu.oam", rp->oam, tp->oam, NES_OAM_SIZE) ||
+           differs_bytes(diff, "ppu.nametable", rp->nametable, tp->nametable, NES_NAMETABLE_SIZE) ||
+           differs_bytes(diff, "ppu.palette", rp->palette, tp->palette, NES_PALETTE_SIZE) ||
+           differs(diff, "controller_shift", 0, ref->controller_shift, test->controller_shift) ||
+           differs(diff, "controller_strobe", 0, ref->controller_strobe, test->controller_strobe) ||
+           differs_apu(diff, &ref->apu, &test->apu);
+}
+
+/* Steps both instances and compares them after every step. When input_seed
+ * is given, both see the same random controller state each step. */
+bool nes_diff_lockstep(nes_t *ref, nes_t *test, nes_step_fn ref_step, nes_step_fn test_step,
+                       uint32_t steps, uint32_t *input_seed, nes_diff_t *diff) {
+    for (uint32_t step = 0; step < steps; step++) {
+        if (input_seed) {
+            uint8_t buttons = (uint8_t)next_random(input_seed);
+            nes_set_controller(ref, buttons);
+            nes_set_controller(test, buttons);
+        }
+        ref_step(ref);
+        test_step(test);
+        if (nes_diff_compare(ref, test, diff)) {
+            diff->step = step;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Fills registers, RAM and PPU memory with random values and points the PC
+ * somewhere in PRG, at the start of a random recompiled block when those
+ * are linked in so the run side actually enters them. ROM contents and host
+ * pointers are left alone. */
+void nes_diff_randomize(nes_t *nes, uint32_t *seed) {
+    nes_cpu_t *cpu = &nes->cpu;
+    nes_ppu_t *ppu = &nes->ppu;
+    cpu->a = (uint8_t)next_random(seed);
+    cpu->x = (uint8_t)next_random(seed);
+    cpu->y = (uint8_t)next_random(seed);
+    cpu->sp = (uint8_t)next_random(seed);
+    cpu->p = (uint8_t)(next_random(seed) | FLAG_U);
+    cpu->pc = (uint16_t)(0x8000u | next_random(seed));
+#ifdef NES_RECOMP
+    if (nes_recomp_block_count) {
+        cpu->pc = nes_recomp_blocks[next_random(seed) % nes_recomp_block_count].pc;
+    }
+#endif
+    for (uint16_t i = 0; i < NES_RAM_SIZE; i++) {
+        nes->ram[i] = (uint8_t)next_random(seed);
+    }
+    for (uint16_t i = 0; i < NES_NAMETABLE_SIZE; i++) {
+        ppu->nametable[i] = (uint8_t)next_random(seed);
+    }
+    for (uint16_t i = 0; i < NES_OAM_SIZE; i++) {
+        ppu->oam[i] = (uint8_t)next_random(seed);
+    }
+    for (uint16_t i = 0; i < NES_PALETTE_SIZE; i++) {
+        ppu->palette[i] = (uint8_t)(next_random(seed) & 0x3F);
+    }
+}
+
+static bool replay(const nes_t *initial, nes_t *ref, nes_t *test, nes_step_fn ref_step,
+                   nes_step_fn test_step, uint32_t input_seed, uint32_t steps, nes_diff_t *diff) {
+    *ref = *initial;
+    *test = *initial;
+    uint32_t seed = input_seed;
+    return nes_diff_lockstep(ref, test, ref_step, test_step, steps, input_seed ? &seed : NULL, diff);
+}
+
+/* Clears RAM of the failing initial image in blocks of 256, 16 and then 1
+ * bytes, keeping each clear that still diverges. Returns the number of bytes
+ * cleared; diff is updated to the divergence of the reduced image. */
+uint16_t nes_diff_minimize(nes_t *initial, nes_t *ref, nes_t *test, nes_step_fn ref_step,
+                           nes_step_fn test_step, uint32_t input_seed, nes_diff_t *diff) {
+    static uint8_t saved[256];
+    uint32_t steps = diff->step + 1;
+    uint16_t cleared = 0;
+    nes_diff_t probe;
+    for (uint16_t block = 256; block > 0; block /= 16) {
+        for (uint16_t base = 0; base < NES_RAM_SIZE; base += block) {
+            uint16_t nonzero = 0;
+            for (uint16_t i = 0; i < block; i++) {
+                nonzero += initial->ram[base + i] != 0;
+            }
+            if (!nonzero) {
+                continue;
+            }
+            memcpy(saved, &initial->ram[base], block);
+            memset(&initial->ram[base], 0, block);
+            if (replay(initial, ref, test, ref_step, test_step, input_seed, steps, &probe)) {
+                *diff = probe;
+                steps = probe.step + 1;
+                cleared += nonzero;
+            } else {
+                memcpy(&initial->ram[base], saved, block);
+            }
+        }
+    }
+    return cleared;
+}
+
+/* Runs rounds of lockstep execution from randomised copies of boot. On the
+ * first divergence the initial image is minimised and left in initial. */
+bool nes_diff_fuzz(const nes_t *boot, nes_t *initial, nes_t *ref, nes_t *test, nes_step_fn ref_step,
+                   nes_step_fn test_step, uint32_t rounds, uint32_t steps, uint32_t seed, nes_diff_t *diff) {
+    for (uint32_t round = 0; round < rounds; round++) {
+        *initial = *boot;
+        nes_set_input_provider(initial, NULL, NULL);
+        nes_diff_randomize(initial, &seed);
+        uint32_t input_seed = next_random(&seed) | 1u;
+        if (replay(initial, ref, test, ref_step, test_step, input_seed, steps, diff)) {
+            nes_diff_minimize(initial, ref, test, ref_step, test_step, input_seed, diff);
+            return true;
+        }
+    }
+    return false;
+}
+
+void nes_diff_report(const nes_diff_t *diff, nes_report_fn emit, void *ctx) {
+    char line[80];
+    snprintf(line, sizeof(line), "step %lu %s[%u] expected %lX actual %lX",
+             (unsigned long)diff->step, diff->field, (unsigned int)diff->offset,
+             (unsigned long)diff->expected, (unsigned long)diff->actual);
+    emit(ctx, line);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef NES_DIFF_H
+#define NES_DIFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nes.h"
+#include "nes_prof.h"
+
+/* Runs two CPU implementations side by side and reports the first state
+ * they disagree on. Built only with -DNES_DIFF, by tools/diff.c on a PC;
+ * the calculator build never runs it. */
+typedef int (*nes_step_fn)(nes_t *nes);
+
+typedef struct {
+    uint32_t step;
+    const char *field;
+    uint16_t offset;
+    uint32_t expected;
+    uint32_t actual;
+} nes_diff_t;
+
+#ifdef NES_DIFF
+int nes_diff_reference_step(nes_t *nes);
+int nes_diff_run_step(nes_t *nes);
+bool nes_diff_compare(const nes_t *ref, const nes_t *test, nes_diff_t *diff);
+bool nes_diff_lockstep(nes_t *ref, nes_t *test, nes_step_fn ref_step, nes_step_fn test_step,
+                       uint32_t steps, uint32_t *input_seed, nes_diff_t *diff);
+void nes_diff_randomize(nes_t *nes, uint32_t *seed);
+uint16_t nes_diff_minimize(nes_t *initial, nes_t *ref, nes_t *test, nes_step_fn ref_step,
+                           nes_step_fn test_step, uint32_t input_seed, nes_diff_t *diff);
+bool nes_diff_fuzz(const nes_t *boot, nes_t *initial, nes_t *ref, nes_t *test, nes_step_fn ref_step,
+                   nes_step_fn test_step, uint32_t rounds, uint32_t steps, uint32_t seed, nes_diff_t *diff);
+void nes_diff_report(const nes_diff_t *diff, nes_report_fn emit, void *ctx);
+#endif
+
+#endif
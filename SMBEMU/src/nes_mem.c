@@ -1,8 +1,14 @@
 #include "nes_mem.h"
 #include "nes_ppu.h"
+#include "nes_apu.h"
+#include "nes_prof.h"
+#include "nes_debug.h"
+#include "nes_perf.h"
+#include <string.h>
 
 static uint8_t ppu_read_register(nes_t *nes, uint16_t addr) {
     nes_ppu_t *ppu = &nes->ppu;
+    NES_PERF_COUNT(ppu_reads[addr & 0x7]);
     switch (addr & 0x7) {
     case 2: {
         uint8_t value = ppu->status;
@@ -21,6 +27,7 @@ static uint8_t ppu_read_register(nes_t *nes, uint16_t addr) {
 
 static void ppu_write_register(nes_t *nes, uint16_t addr, uint8_t value) {
     nes_ppu_t *ppu = &nes->ppu;
+    NES_PERF_COUNT(ppu_writes[addr & 0x7]);
     switch (addr & 0x7) {
     case 0:
         ppu->ctrl = value;
@@ -67,14 +74,22 @@ static void ppu_write_register(nes_t *nes, uint16_t addr, uint8_t value) {
 }
 
 uint8_t nes_cpu_read(nes_t *nes, uint16_t addr) {
+    NES_PROF_BUS(addr, false);
+    NES_DEBUG_BUS(nes, addr, 0, false);
     if (addr < 0x2000) {
         uint16_t ram_index = (uint16_t)(addr % 0x0800u);
+        NES_PERF_COUNT(bus_reads[NES_BUS_RAM]);
         return nes->ram[ram_index];
     }
     if (addr < 0x4000) {
         return ppu_read_register(nes, addr);
     }
+    if (addr == 0x4015) {
+        NES_PERF_COUNT(bus_reads[NES_BUS_OTHER]);
+        return nes_apu_read_status(nes);
+    }
     if (addr == 0x4016) {
+        NES_PERF_COUNT(bus_reads[NES_BUS_INPUT]);
         uint8_t value = (nes->controller_shift & 1) | 0x40;
         if (!nes->controller_strobe) {
             nes->controller_shift >>= 1;
@@ -82,14 +97,19 @@ uint8_t nes_cpu_read(nes_t *nes, uint16_t addr) {
         return value;
     }
     if (addr >= 0x8000) {
+        NES_PERF_COUNT(bus_reads[NES_BUS_PRG]);
         return nes->prg[addr - 0x8000];
     }
+    NES_PERF_COUNT(bus_reads[NES_BUS_OTHER]);
     return 0;
 }
 
 void nes_cpu_write(nes_t *nes, uint16_t addr, uint8_t value) {
+    NES_PROF_BUS(addr, true);
+    NES_DEBUG_BUS(nes, addr, value, true);
     if (addr < 0x2000) {
         uint16_t ram_index = (uint16_t)(addr % 0x0800u);
+        NES_PERF_COUNT(bus_writes[NES_BUS_RAM]);
         nes->ram[ram_index] = value;
         return;
     }
@@ -98,19 +118,30 @@ void nes_cpu_write(nes_t *nes, uint16_t addr, uint8_t value) {
         return;
     }
     if (addr == 0x4014) {
+        NES_PERF_COUNT(oam_dmas);
         uint16_t base = (uint16_t)value * 0x0100u;
         for (uint16_t i = 0; i < 256; i++) {
             nes->ppu.oam[i] = nes_cpu_read(nes, base + i);
         }
+        nes->sched.now += NES_OAM_DMA_CYCLES;
         return;
     }
     if (addr == 0x4016) {
+        NES_PERF_COUNT(bus_writes[NES_BUS_INPUT]);
         nes->controller_strobe = (value & 1) != 0;
         if (nes->controller_strobe) {
+            if (nes->input_provider) {
+                nes->controller_state = nes->input_provider(nes->input_ctx);
+            }
             nes->controller_shift = nes->controller_state;
         }
         return;
     }
+    NES_PERF_COUNT(bus_writes[NES_BUS_OTHER]);
+    if (addr <= 0x4013 || addr == 0x4015 || addr == 0x4017) {
+        nes_apu_write(nes, addr, value);
+        return;
+    }
     (void)value;
 }
 
@@ -120,3 +151,18 @@ void nes_set_controller(nes_t *nes, uint8_t state) {
         nes->controller_shift = state;
     }
 }
+
+/* Clears all state and maps rom, which must outlive nes. */
+void nes_init(nes_t *nes, const nes_rom_t *rom) {
+    memset(nes, 0, sizeof(*nes));
+    nes->prg = rom->prg;
+    nes->chr = rom->chr;
+    nes_ppu_set_mirroring(nes, (nes_mirroring_t)rom->mirroring);
+}
+
+/* The provider is polled when the game strobes $4016, so the latched buttons
+ * are as fresh as the game's own read. */
+void nes_set_input_provider(nes_t *nes, nes_input_fn provider, void *ctx) {
+    nes->input_provider = provider;
+    nes->input_ctx = ctx;
+}
@@ -5,9 +5,21 @@
 #include <stdbool.h>
 #include "nes.h"
 
+typedef enum {
+    NES_BUS_RAM,
+    NES_BUS_PPU,
+    NES_BUS_INPUT,
+    NES_BUS_PRG,
+    NES_BUS_OTHER,
+    NES_BUS_REGION_COUNT
+} nes_bus_region_t;
+
+void nes_init(nes_t *nes, const nes_rom_t *rom);
+
 uint8_t nes_cpu_read(nes_t *nes, uint16_t addr);
 void nes_cpu_write(nes_t *nes, uint16_t addr, uint8_t value);
 
 void nes_set_controller(nes_t *nes, uint8_t state);
+void nes_set_input_provider(nes_t *nes, nes_input_fn provider, void *ctx);
 
 #endif
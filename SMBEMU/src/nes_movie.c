@@ -0,0 +1,73 @@
+#include "nes_movie.h"
+#include <string.h>
+
+void nes_movie_start(nes_movie_t *movie, const uint8_t *inputs, uint32_t frames,
+                     const char *golden, size_t golden_size) {
+    memset(movie, 0, sizeof(*movie));
+    movie->inputs = inputs;
+    movie->frames = frames;
+    movie->golden = golden;
+    movie->golden_size = golden ? golden_size : 0;
+}
+
+/* Input provider for nes_set_input_provider. */
+uint8_t nes_movie_input(void *ctx) {
+    const nes_movie_t *movie = ctx;
+    return movie->frame < movie->frames ? movie->inputs[movie->frame] : 0;
+}
+
+bool nes_movie_done(const nes_movie_t *movie) {
+    return movie->frame >= movie->frames;
+}
+
+static bool next_golden(nes_movie_t *movie, uint64_t *hash) {
+    uint64_t value = 0;
+    int digits = 0;
+    while (movie->golden_pos < movie->golden_size) {
+        char c = movie->golden[movie->golden_pos++];
+        int nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else if (c == '\n' && digits) {
+            break;
+        } else {
+            continue;
+        }
+        value = (value << 4) | (uint64_t)nibble;
+        digits++;
+    }
+    *hash = value;
+    return digits > 0;
+}
+
+/* Advances to the next frame. Returns false only when a golden hash exists
+ * for this frame and differs. */
+bool nes_movie_check(nes_movie_t *movie, uint64_t hash) {
+    uint32_t frame = movie->frame++;
+    uint64_t expected;
+    if (!next_golden(movie, &expected)) {
+        return true;
+    }
+    movie->checked++;
+    if (expected == hash) {
+        return true;
+    }
+    if (movie->mismatches++ == 0) {
+        movie->first_mismatch = frame;
+    }
+    return false;
+}
+
+/* Writes 16 hex digits and a terminator into line, which needs 17 bytes. */
+void nes_movie_format_hash(uint64_t hash, char *line) {
+    static const char digits[] = "0123456789ABCDEF";
+    for (int i = 15; i >= 0; i--) {
+        line[i] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+    line[16] = '\0';
+}
@@ -0,0 +1,29 @@
+#ifndef NES_MOVIE_H
+#define NES_MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Replays one controller byte per frame and checks each rendered frame's
+ * hash against a golden list of 16-digit hex hashes, one per line. */
+typedef struct {
+    const uint8_t *inputs;
+    uint32_t frames;
+    uint32_t frame;
+    const char *golden;
+    size_t golden_size;
+    size_t golden_pos;
+    uint32_t checked;
+    uint32_t mismatches;
+    uint32_t first_mismatch;
+} nes_movie_t;
+
+void nes_movie_start(nes_movie_t *movie, const uint8_t *inputs, uint32_t frames,
+                     const char *golden, size_t golden_size);
+uint8_t nes_movie_input(void *ctx);
+bool nes_movie_done(const nes_movie_t *movie);
+bool nes_movie_check(nes_movie_t *movie, uint64_t hash);
+void nes_movie_format_hash(uint64_t hash, char *line);
+
+#endif
@@ -0,0 +1,150 @@
+#include "nes_opcodes.h"
+
+/* Official 6502 opcodes; everything else is "???" with implied addressing. */
+const char nes_opcode_names[256][4] = {
+    "BRK", "ORA", "???", "???", "???", "ORA", "ASL", "???",
+    "PHP", "ORA", "ASL", "???", "???", "ORA", "ASL", "???",
+    "BPL", "ORA", "???", "???", "???", "ORA", "ASL", "???",
+    "CLC", "ORA", "???", "???", "???", "ORA", "ASL", "???",
+    "JSR", "AND", "???", "???", "BIT", "AND", "ROL", "???",
+    "PLP", "AND", "ROL", "???", "BIT", "AND", "ROL", "???",
+    "BMI", "AND", "???", "???", "???", "AND", "ROL", "???",
+    "SEC", "AND", "???", "???", "???", "AND", "ROL", "???",
+    "RTI", "EOR", "???", "???", "???", "EOR", "LSR", "???",
+    "PHA", "EOR", "LSR", "???", "JMP", "EOR", "LSR", "???",
+    "BVC", "EOR", "???", "???", "???", "EOR", "LSR", "???",
+    "CLI", "EOR", "???", "???", "???", "EOR", "LSR", "???",
+    "RTS", "ADC", "???", "???", "???", "ADC", "ROR", "???",
+    "PLA", "ADC", "ROR", "???", "JMP", "ADC", "ROR", "???",
+    "BVS", "ADC", "???", "???", "???", "ADC", "ROR", "???",
+    "SEI", "ADC", "???", "???", "???", "ADC", "ROR", "???",
+    "???", "STA", "???", "???", "STY", "STA", "STX", "???",
+    "DEY", "???", "TXA", "???", "STY", "STA", "STX", "???",
+    "BCC", "STA", "???", "???", "STY", "STA", "STX", "???",
+    "TYA", "STA", "TXS", "???", "???", "STA", "???", "???",
+    "LDY", "LDA", "LDX", "???", "LDY", "LDA", "LDX", "???",
+    "TAY", "LDA", "TAX", "???", "LDY", "LDA", "LDX", "???",
+    "BCS", "LDA", "???", "???", "LDY", "LDA", "LDX", "???",
+    "CLV", "LDA", "TSX", "???", "LDY", "LDA", "LDX", "???",
+    "CPY", "CMP", "???", "???", "CPY", "CMP", "DEC", "???",
+    "INY", "CMP", "DEX", "???", "CPY", "CMP", "DEC", "???",
+    "BNE", "CMP", "???", "???", "???", "CMP", "DEC", "???",
+    "CLD", "CMP", "???", "???", "???", "CMP", "DEC", "???",
+    "CPX", "SBC", "???", "???", "CPX", "SBC", "INC", "???",
+    "INX", "SBC", "NOP", "???", "CPX", "SBC", "INC", "???",
+    "BEQ", "SBC", "???", "???", "???", "SBC", "INC", "???",
+    "SED", "SBC", "???", "???", "???", "SBC", "INC", "???"
+};
+
+const uint8_t nes_opcode_modes[256] = {
+    NES_MODE_IMP, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_ACC, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_ABX, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ZP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_ACC, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_ABX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_ACC, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_ABX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_ACC, NES_MODE_IMP,
+    NES_MODE_IND, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_ABX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ZP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMP, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_ZPY, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMM, NES_MODE_IZX, NES_MODE_IMM, NES_MODE_IMP,
+    NES_MODE_ZP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_ZPY, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ABX, NES_MODE_ABX, NES_MODE_ABY, NES_MODE_IMP,
+    NES_MODE_IMM, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ZP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_ABX, NES_MODE_IMP,
+    NES_MODE_IMM, NES_MODE_IZX, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ZP, NES_MODE_ZP, NES_MODE_ZP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_IMM, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_ABS, NES_MODE_ABS, NES_MODE_ABS, NES_MODE_IMP,
+    NES_MODE_REL, NES_MODE_IZY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ZPX, NES_MODE_ZPX, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABY, NES_MODE_IMP, NES_MODE_IMP,
+    NES_MODE_IMP, NES_MODE_ABX, NES_MODE_ABX, NES_MODE_IMP
+};
+
+/* Base cycles charged by the interpreter. A taken branch adds 1, or 2 when
+ * it lands on another page, and abs,X, abs,Y and (zp),Y reads add 1 when
+ * they cross a page; those are not in the table. */
+const uint8_t nes_opcode_cycles[256] = {
+    7, 6, 2, 2, 2, 3, 5, 2,
+    3, 2, 2, 2, 2, 4, 6, 2,
+    2, 5, 2, 2, 2, 4, 6, 2,
+    2, 4, 2, 2, 2, 4, 7, 2,
+    6, 6, 2, 2, 3, 3, 5, 2,
+    4, 2, 2, 2, 4, 4, 6, 2,
+    2, 5, 2, 2, 2, 4, 6, 2,
+    2, 4, 2, 2, 2, 4, 7, 2,
+    6, 6, 2, 2, 2, 3, 5, 2,
+    3, 2, 2, 2, 3, 4, 6, 2,
+    2, 5, 2, 2, 2, 4, 6, 2,
+    2, 4, 2, 2, 2, 4, 7, 2,
+    6, 6, 2, 2, 2, 3, 5, 2,
+    4, 2, 2, 2, 5, 4, 6, 2,
+    2, 5, 2, 2, 2, 4, 6, 2,
+    2, 4, 2, 2, 2, 4, 7, 2,
+    2, 6, 2, 2, 3, 3, 3, 2,
+    2, 2, 2, 2, 4, 4, 4, 2,
+    2, 6, 2, 2, 4, 4, 4, 2,
+    2, 5, 2, 2, 2, 5, 2, 2,
+    2, 6, 2, 2, 3, 3, 3, 2,
+    2, 2, 2, 2, 4, 4, 4, 2,
+    2, 5, 2, 2, 4, 4, 4, 2,
+    2, 4, 2, 2, 4, 4, 4, 2,
+    2, 6, 2, 2, 3, 3, 5, 2,
+    2, 2, 2, 2, 4, 4, 6, 2,
+    2, 5, 2, 2, 2, 4, 6, 2,
+    2, 4, 2, 2, 2, 4, 7, 2,
+    2, 6, 2, 2, 3, 3, 5, 2,
+    2, 2, 2, 2, 4, 4, 6, 2,
+    2, 5, 2, 2, 2, 4, 6, 2,
+    2, 4, 2, 2, 2, 4, 7, 2
+};
+
+const uint8_t nes_mode_lengths[NES_MODE_COUNT] = {
+    1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2
+};
+
+const char nes_mode_names[NES_MODE_COUNT][4] = {
+    "imp", "acc", "imm", "zp", "zpx", "zpy", "abs", "abx", "aby", "ind", "izx", "izy", "rel"
+};
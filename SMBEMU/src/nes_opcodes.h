@@ -0,0 +1,29 @@
+#ifndef NES_OPCODES_H
+#define NES_OPCODES_H
+
+#include <stdint.h>
+
+typedef enum {
+    NES_MODE_IMP,
+    NES_MODE_ACC,
+    NES_MODE_IMM,
+    NES_MODE_ZP,
+    NES_MODE_ZPX,
+    NES_MODE_ZPY,
+    NES_MODE_ABS,
+    NES_MODE_ABX,
+    NES_MODE_ABY,
+    NES_MODE_IND,
+    NES_MODE_IZX,
+    NES_MODE_IZY,
+    NES_MODE_REL,
+    NES_MODE_COUNT
+} nes_mode_t;
+
+extern const char nes_opcode_names[256][4];
+extern const uint8_t nes_opcode_modes[256];
+extern const uint8_t nes_opcode_cycles[256];
+extern const uint8_t nes_mode_lengths[NES_MODE_COUNT];
+extern const char nes_mode_names[NES_MODE_COUNT][4];
+
+#endif
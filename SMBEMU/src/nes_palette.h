@@ -0,0 +1,10 @@
+#ifndef NES_PALETTE_H
+#define NES_PALETTE_H
+
+#include <stdint.h>
+
+/* The 64 PPU colours as 0xRRGGBB. Kept apart from the renderer so PC tools
+ * can link it without graphx. */
+extern const uint32_t nes_palette_rgb[64];
+
+#endif
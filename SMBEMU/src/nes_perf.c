@@ -0,0 +1,67 @@
+#include "nes_perf.h"
+
+#ifdef NES_PERF
+
+#include <stdio.h>
+#include <string.h>
+
+nes_perf_counters_t nes_perf;
+
+static const char *const region_names[NES_BUS_REGION_COUNT] = {
+    "ram", "ppu", "4016", "prg", "other"
+};
+
+void nes_perf_reset(void) {
+    memset(&nes_perf, 0, sizeof(nes_perf));
+}
+
+/* Copies the counters and fills in the ones derived from others. */
+void nes_perf_read(nes_perf_counters_t *out) {
+    *out = nes_perf;
+    out->bus_reads[NES_BUS_PPU] = 0;
+    out->bus_writes[NES_BUS_PPU] = 0;
+    for (int i = 0; i < 8; i++) {
+        out->bus_reads[NES_BUS_PPU] += out->ppu_reads[i];
+        out->bus_writes[NES_BUS_PPU] += out->ppu_writes[i];
+    }
+    out->bus_writes[NES_BUS_OTHER] += out->oam_dmas;
+    out->vram_transfers = out->ppu_reads[7] + out->ppu_writes[7];
+}
+
+static void emit_value(nes_report_fn emit, void *ctx, const char *name, uint32_t value) {
+    char line[48];
+    snprintf(line, sizeof(line), "%s %lu", name, (unsigned long)value);
+    emit(ctx, line);
+}
+
+/* One "name value" line per scalar counter, then the per-region and
+ * per-register tables, so successive dumps can be diffed line by line. */
+void nes_perf_report(nes_report_fn emit, void *ctx) {
+    nes_perf_counters_t counters;
+    char line[48];
+
+    nes_perf_read(&counters);
+    emit_value(emit, ctx, "instructions", counters.instructions);
+    emit_value(emit, ctx, "blocks", counters.blocks);
+    emit_value(emit, ctx, "cycles", counters.cycles);
+    emit_value(emit, ctx, "vram_transfers", counters.vram_transfers);
+    emit_value(emit, ctx, "oam_dmas", counters.oam_dmas);
+    emit_value(emit, ctx, "nmis", counters.nmis);
+    emit_value(emit, ctx, "frames_rendered", counters.frames_rendered);
+    emit_value(emit, ctx, "frames_skipped", counters.frames_skipped);
+    emit_value(emit, ctx, "pixels", counters.pixels);
+    emit(ctx, "# region reads writes");
+    for (int i = 0; i < NES_BUS_REGION_COUNT; i++) {
+        snprintf(line, sizeof(line), "%s %lu %lu", region_names[i],
+                 (unsigned long)counters.bus_reads[i], (unsigned long)counters.bus_writes[i]);
+        emit(ctx, line);
+    }
+    emit(ctx, "# register reads writes");
+    for (int i = 0; i < 8; i++) {
+        snprintf(line, sizeof(line), "200%d %lu %lu", i,
+                 (unsigned long)counters.ppu_reads[i], (unsigned long)counters.ppu_writes[i]);
+        emit(ctx, line);
+    }
+}
+
+#endif
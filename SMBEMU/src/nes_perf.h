@@ -0,0 +1,51 @@
+#ifndef NES_PERF_H
+#define NES_PERF_H
+
+#include <stdint.h>
+#include "nes_mem.h"
+#include "nes_prof.h"
+
+/* Event counters cheap enough to leave on for long runs, unlike the
+ * PROFILE histograms. Every hook is a single increment or add into the
+ * global nes_perf, and all of them compile to nothing unless NES_PERF is
+ * defined. Counters are 32-bit and wrap; sample them with nes_perf_read and
+ * take differences for runs longer than about 40 emulated minutes.
+ *
+ * Each path is counted once. A PPU register access only counts against its
+ * register and a $4014 write only as an OAM DMA, so the NES_BUS_PPU bus
+ * counts, the $4014 share of NES_BUS_OTHER writes and vram_transfers
+ * ($2007 both ways) are filled in by nes_perf_read. Writes above $4000
+ * other than $4014 and $4016 all count as NES_BUS_OTHER.
+ * cycles only covers nes_cpu_run. Recompiled blocks count as blocks rather
+ * than instructions, and their stack and zero-page accesses bypass the bus
+ * counters. */
+typedef struct {
+    uint32_t instructions;
+    uint32_t blocks;
+    uint32_t cycles;
+    uint32_t bus_reads[NES_BUS_REGION_COUNT];
+    uint32_t bus_writes[NES_BUS_REGION_COUNT];
+    uint32_t ppu_reads[8];
+    uint32_t ppu_writes[8];
+    uint32_t vram_transfers;
+    uint32_t oam_dmas;
+    uint32_t nmis;
+    uint32_t frames_rendered;
+    uint32_t frames_skipped;
+    uint32_t pixels;
+} nes_perf_counters_t;
+
+#ifdef NES_PERF
+extern nes_perf_counters_t nes_perf;
+
+void nes_perf_reset(void);
+void nes_perf_read(nes_perf_counters_t *out);
+void nes_perf_report(nes_report_fn emit, void *ctx);
+#define NES_PERF_COUNT(field) ((void)nes_perf.field++)
+#define NES_PERF_ADD(field, n) ((void)(nes_perf.field += (uint32_t)(n)))
+#else
+#define NES_PERF_COUNT(field) ((void)0)
+#define NES_PERF_ADD(field, n) ((void)0)
+#endif
+
+#endif
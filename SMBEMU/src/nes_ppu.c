@@ -1,18 +1,10 @@
 #include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_palette.h"
+#include "nes_perf.h"
 #include <graphx.h>
 #include <string.h>
 
-static const uint32_t nes_palette_rgb[64] = {
-    0x545454, 0x001E74, 0x081090, 0x300088, 0x440064, 0x5C0030, 0x540400, 0x3C1800,
-    0x202A00, 0x083A00, 0x004000, 0x003C00, 0x00323C, 0x000000, 0x000000, 0x000000,
-    0x989698, 0x084CC4, 0x3032EC, 0x5C1EE4, 0x8814B0, 0xA01464, 0x982220, 0x783C00,
-    0x545A00, 0x287200, 0x087C00, 0x007628, 0x006678, 0x000000, 0x000000, 0x000000,
-    0xECEEEC, 0x4C9AEC, 0x787CEC, 0xB062EC, 0xE454EC, 0xEC58B4, 0xEC6A64, 0xD48820,
-    0xA0AA00, 0x74C400, 0x4CD020, 0x38CC6C, 0x38B4CC, 0x3C3C3C, 0x000000, 0x000000,
-    0xECEEEC, 0xA8CCEC, 0xBCBCEC, 0xD4B2EC, 0xECAEEC, 0xECAED4, 0xECB4B0, 0xE4C490,
-    0xCCD278, 0xB4DE78, 0xA8E290, 0x98E2B4, 0xA0D6E4, 0xA0A2A0, 0x000000, 0x000000
-};
-
 static void init_palette(void) {
     static bool initialized = false;
     static uint16_t palette_1555[64];
@@ -29,25 +21,60 @@ static void init_palette(void) {
     initialized = true;
 }
 
+/* VRAM offsets of the four logical nametables, per nes_mirroring_t. */
+static const uint16_t mirror_pages[4][4] = {
+    { 0x000, 0x000, 0x400, 0x400 },
+    { 0x000, 0x400, 0x000, 0x400 },
+    { 0x000, 0x000, 0x000, 0x000 },
+    { 0x400, 0x400, 0x400, 0x400 }
+};
+
+/* Mirroring survives a reset; it belongs to the cartridge. */
 void nes_ppu_reset(nes_t *nes) {
     nes_ppu_t *ppu = &nes->ppu;
+    nes_mirroring_t mirroring = (nes_mirroring_t)ppu->mirroring;
     memset(ppu, 0, sizeof(*ppu));
+    nes_ppu_set_mirroring(nes, mirroring);
     ppu->status = 0x00;
     ppu->vram_addr = 0;
     ppu->temp_addr = 0;
     ppu->addr_latch = false;
     ppu->data_buffer = 0;
     init_palette();
+    nes_ppu_start_frame(nes, nes->sched.now);
+}
+
+void nes_ppu_start_frame(nes_t *nes, uint32_t frame_time) {
+    nes_ppu_t *ppu = &nes->ppu;
+    ppu->status &= ~0xC0;
+    nes_sched_add(nes, NES_EVENT_VBLANK, frame_time + NES_VBLANK_CYCLE);
+    nes_sched_add(nes, NES_EVENT_FRAME_START, frame_time + NES_FRAME_CYCLES);
+    uint8_t sprite0_y = ppu->oam[0];
+    if (sprite0_y < NES_SCREEN_HEIGHT - 1) {
+        uint32_t dot = (uint32_t)(sprite0_y + 1) * 341u + ppu->oam[3];
+        nes_sched_add(nes, NES_EVENT_SPRITE0, frame_time + dot / 3u);
+    } else {
+        nes_sched_cancel(nes, NES_EVENT_SPRITE0);
+    }
+}
+
+/* Resolved once, on load or when a mapper switches layout, so that VRAM
+ * accesses and the renderer only ever index the page table. Pages are
+ * offsets rather than pointers so a nes_t stays valid when copied. */
+void nes_ppu_set_mirroring(nes_t *nes, nes_mirroring_t mirroring) {
+    nes_ppu_t *ppu = &nes->ppu;
+    ppu->mirroring = (uint8_t)mirroring;
+    memcpy(ppu->nametable_page, mirror_pages[mirroring], sizeof(ppu->nametable_page));
 }
 
 static uint8_t ppu_read_vram(nes_t *nes, uint16_t addr) {
     nes_ppu_t *ppu = &nes->ppu;
     addr &= 0x3FFF;
     if (addr < 0x2000) {
-        return ppu->chr[addr];
+        return nes->chr[addr];
     }
     if (addr < 0x3F00) {
-        return ppu->nametable[addr & 0x7FF];
+        return ppu->nametable[ppu->nametable_page[(addr >> 10) & 3] + (addr & 0x3FF)];
     }
     return ppu->palette[addr & 0x1F];
 }
@@ -59,7 +86,7 @@ static void ppu_write_vram(nes_t *nes, uint16_t addr, uint8_t value) {
         return;
     }
     if (addr < 0x3F00) {
-        ppu->nametable[addr & 0x7FF] = value;
+        ppu->nametable[ppu->nametable_page[(addr >> 10) & 3] + (addr & 0x3FF)] = value;
         return;
     }
     ppu->palette[addr & 0x1F] = value & 0x3F;
@@ -87,53 +114,86 @@ void nes_ppu_write_data(nes_t *nes, uint8_t value) {
     ppu->vram_addr += (ppu->ctrl & 0x04) ? 32 : 1;
 }
 
-static void render_background(nes_t *nes, uint8_t *buffer, int x_offset) {
-    nes_ppu_t *ppu = &nes->ppu;
-    uint16_t base = (ppu->ctrl & 0x10) ? 0x1000 : 0x0000;
-    uint16_t scroll = ppu->scroll_x;
+/* One pattern row: eight pixels, colors[0] for transparent ones. */
+void nes_ppu_tile_row(uint8_t *dst, uint8_t plane0, uint8_t plane1, const uint8_t *colors) {
+    for (int bit = 7; bit >= 0; bit--) {
+        *dst++ = colors[((plane0 >> bit) & 1) | (((plane1 >> bit) & 1) << 1)];
+    }
+}
+
+/* As nes_ppu_tile_row, but transparent pixels are left alone. */
+void nes_ppu_sprite_row(uint8_t *dst, uint8_t plane0, uint8_t plane1, const uint8_t *colors) {
+    for (int bit = 7; bit >= 0; bit--, dst++) {
+        uint8_t color = ((plane0 >> bit) & 1) | (((plane1 >> bit) & 1) << 1);
+        if (color) {
+            *dst = colors[color];
+        }
+    }
+}
+
+static uint8_t reverse_bits(uint8_t value) {
+    value = (uint8_t)((value & 0xF0) >> 4 | (value & 0x0F) << 4);
+    value = (uint8_t)((value & 0xCC) >> 2 | (value & 0x33) << 2);
+    return (uint8_t)((value & 0xAA) >> 1 | (value & 0x55) << 1);
+}
+
+/* Draws 33 whole tiles per scanline into line and copies out the 256
+ * pixels that fine X scroll leaves visible. */
+static void render_background(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer, int x_offset) {
+    static uint8_t line[NES_SCREEN_WIDTH + 8];
+    uint8_t colors[4][4];
+    const uint8_t *patterns = chr + ((frame->ctrl & 0x10) ? 0x1000 : 0x0000);
+    int first_tile = ((frame->ctrl & 0x01) ? 32 : 0) + (frame->scroll_x >> 3);
+    int first_row = (frame->ctrl & 0x02) ? 30 : 0;
+    uint8_t fine_x = frame->scroll_x & 7;
 
+    for (int palette = 0; palette < 4; palette++) {
+        colors[palette][0] = frame->palette[0] & 0x3F;
+        for (int color = 1; color < 4; color++) {
+            colors[palette][color] = frame->palette[palette * 4 + color] & 0x3F;
+        }
+    }
     for (int y = 0; y < NES_SCREEN_HEIGHT; y++) {
-        int world_y = y + ppu->scroll_y;
-        int tile_y = (world_y / 8) % 30;
+        int world_y = y + frame->scroll_y;
+        int row = first_row + world_y / 8;
+        int tile_y = row % 30;
         int fine_y = world_y % 8;
-        for (int x = 0; x < NES_SCREEN_WIDTH; x++) {
-            int world_x = x + scroll;
-            int name_x = (world_x / 8) % 64;
-            int fine_x = world_x % 8;
-            int table = (name_x >= 32) ? 1 : 0;
+        const uint16_t *pages = frame->nametable_page + ((row / 30) & 1) * 2;
+        uint8_t *out = line;
+        for (int i = 0; i <= NES_SCREEN_WIDTH / 8; i++) {
+            int name_x = (first_tile + i) % 64;
             int tile_x = name_x % 32;
-            uint16_t nt_index = table * 0x400 + tile_y * 32 + tile_x;
-            uint8_t tile = ppu->nametable[nt_index & 0x7FF];
-            uint16_t pattern = base + tile * 16;
-            uint8_t plane0 = ppu->chr[pattern + fine_y];
-            uint8_t plane1 = ppu->chr[pattern + fine_y + 8];
-            uint8_t bit = 7 - fine_x;
-            uint8_t color = ((plane0 >> bit) & 1) | (((plane1 >> bit) & 1) << 1);
-            uint16_t attr_index = table * 0x400 + 0x3C0 + (tile_y / 4) * 8 + (tile_x / 4);
-            uint8_t attr = ppu->nametable[attr_index & 0x7FF];
+            const uint8_t *table = frame->nametable + pages[name_x >= 32];
+            const uint8_t *pattern = patterns + table[tile_y * 32 + tile_x] * 16 + fine_y;
+            uint8_t attr = table[0x3C0 + (tile_y / 4) * 8 + (tile_x / 4)];
             uint8_t shift = ((tile_y & 2) ? 4 : 0) + ((tile_x & 2) ? 2 : 0);
-            uint8_t palette = (attr >> shift) & 3;
-            uint8_t final_color = 0;
-            if (color) {
-                final_color = ppu->palette[palette * 4 + color] & 0x3F;
-            } else {
-                final_color = ppu->palette[0] & 0x3F;
-            }
-            buffer[y * 320 + x_offset + x] = final_color;
+            NES_PPU_TILE_ROW(out, pattern[0], pattern[8], colors[(attr >> shift) & 3]);
+            out += 8;
         }
+        memcpy(buffer + y * 320 + x_offset, line + fine_x, NES_SCREEN_WIDTH);
     }
+    NES_PERF_ADD(pixels, NES_SCREEN_WIDTH * NES_SCREEN_HEIGHT);
 }
 
-static void render_sprites(nes_t *nes, uint8_t *buffer, int x_offset) {
-    nes_ppu_t *ppu = &nes->ppu;
-    bool sprite_8x16 = (ppu->ctrl & 0x20) != 0;
-    uint16_t base = (ppu->ctrl & 0x08) ? 0x1000 : 0x0000;
+/* Flipped rows are mirrored and rows that run off the right edge are masked
+ * before the kernel sees them, so it only ever draws left to right. */
+static void render_sprites(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer, int x_offset) {
+    bool sprite_8x16 = (frame->ctrl & 0x20) != 0;
+    uint16_t base = (frame->ctrl & 0x08) ? 0x1000 : 0x0000;
+    uint8_t colors[4][4];
+    for (int palette = 0; palette < 4; palette++) {
+        colors[palette][0] = 0;
+        for (int color = 1; color < 4; color++) {
+            colors[palette][color] = frame->palette[(palette + 4) * 4 + color] & 0x3F;
+        }
+    }
     for (int i = 63; i >= 0; i--) {
         int index = i * 4;
-        uint8_t y = ppu->oam[index];
-        uint8_t tile = ppu->oam[index + 1];
-        uint8_t attr = ppu->oam[index + 2];
-        uint8_t x = ppu->oam[index + 3];
+        uint8_t y = frame->oam[index];
+        uint8_t tile = frame->oam[index + 1];
+        uint8_t attr = frame->oam[index + 2];
+        uint8_t x = frame->oam[index + 3];
+        uint8_t mask = x > NES_SCREEN_WIDTH - 8 ? (uint8_t)(0xFF << (x - (NES_SCREEN_WIDTH - 8))) : 0xFF;
         int sprite_height = sprite_8x16 ? 16 : 8;
         for (int row = 0; row < sprite_height; row++) {
             int draw_y = y + 1 + row;
@@ -153,35 +213,101 @@ static void render_sprites(nes_t *nes, uint8_t *buffer, int x_offset) {
             } else {
                 pattern_addr = base + tile * 16 + tile_row;
             }
-            uint8_t plane0 = ppu->chr[pattern_addr];
-            uint8_t plane1 = ppu->chr[pattern_addr + 8];
-            for (int col = 0; col < 8; col++) {
-                int draw_x = x + col;
-                if (draw_x < 0 || draw_x >= NES_SCREEN_WIDTH) {
-                    continue;
-                }
-                int bit = (attr & 0x40) ? col : (7 - col);
-                uint8_t color = ((plane0 >> bit) & 1) | (((plane1 >> bit) & 1) << 1);
-                if (color == 0) {
-                    continue;
-                }
-                uint8_t palette = (attr & 0x03) + 4;
-                uint8_t final_color = ppu->palette[palette * 4 + color] & 0x3F;
-                buffer[draw_y * 320 + x_offset + draw_x] = final_color;
+            uint8_t plane0 = chr[pattern_addr];
+            uint8_t plane1 = chr[pattern_addr + 8];
+            if (attr & 0x40) {
+                plane0 = reverse_bits(plane0);
+                plane1 = reverse_bits(plane1);
             }
+            NES_PPU_SPRITE_ROW(buffer + draw_y * 320 + x_offset + x, plane0 & mask, plane1 & mask,
+                               colors[attr & 0x03]);
+            NES_PERF_ADD(pixels, 8);
         }
     }
 }
 
-void nes_ppu_render_frame(nes_t *nes) {
-    nes_ppu_t *ppu = &nes->ppu;
-    uint8_t *buffer = gfx_vbuffer;
+void nes_ppu_capture(const nes_t *nes, nes_ppu_frame_t *frame) {
+    const nes_ppu_t *ppu = &nes->ppu;
+    frame->ctrl = ppu->ctrl;
+    frame->mask = ppu->mask;
+    frame->scroll_x = ppu->scroll_x;
+    frame->scroll_y = ppu->scroll_y;
+    memcpy(frame->oam, ppu->oam, sizeof(frame->oam));
+    memcpy(frame->nametable_page, ppu->nametable_page, sizeof(frame->nametable_page));
+    memcpy(frame->nametable, ppu->nametable, sizeof(frame->nametable));
+    memcpy(frame->palette, ppu->palette, sizeof(frame->palette));
+}
+
+void nes_ppu_draw_background(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer) {
+    render_background(frame, chr, buffer, (320 - NES_SCREEN_WIDTH) / 2);
+}
+
+void nes_ppu_draw_sprites(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer) {
+    render_sprites(frame, chr, buffer, (320 - NES_SCREEN_WIDTH) / 2);
+}
+
+void nes_ppu_draw(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer) {
     int x_offset = (320 - NES_SCREEN_WIDTH) / 2;
-    gfx_FillScreen(0);
-    render_background(nes, buffer, x_offset);
-    render_sprites(nes, buffer, x_offset);
+    render_background(frame, chr, buffer, x_offset);
+    render_sprites(frame, chr, buffer, x_offset);
+}
+
+/* FNV-1a over the 256x240 picture, fed four pixels at a time. */
+uint64_t nes_ppu_frame_hash(const uint8_t *buffer) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    const uint8_t *row = buffer + (320 - NES_SCREEN_WIDTH) / 2;
+    for (int y = 0; y < NES_SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < NES_SCREEN_WIDTH; x += 4) {
+            uint32_t word = (uint32_t)row[x] | (uint32_t)row[x + 1] << 8 |
+                            (uint32_t)row[x + 2] << 16 | (uint32_t)row[x + 3] << 24;
+            hash = (hash ^ word) * 0x100000001B3ull;
+        }
+        row += 320;
+    }
+    return hash;
+}
+
+void nes_ppu_vblank(nes_t *nes) {
+    nes_ppu_t *ppu = &nes->ppu;
     ppu->status |= 0x80;
     if (ppu->ctrl & 0x80) {
         nes->cpu.nmi_pending = true;
     }
 }
+
+void nes_ppu_render_frame(nes_t *nes) {
+    static nes_ppu_frame_t frame;
+    nes_ppu_capture(nes, &frame);
+    gfx_FillScreen(0);
+    nes_ppu_draw(&frame, nes->chr, gfx_vbuffer);
+}
+
+void nes_ppu_pipe_init(nes_ppu_pipe_t *pipe) {
+    nes_atomic_store(&pipe->published, 0);
+    nes_atomic_store(&pipe->consumed, 0);
+}
+
+nes_ppu_frame_t *nes_ppu_pipe_back(nes_ppu_pipe_t *pipe) {
+    unsigned int published = nes_atomic_load(&pipe->published);
+    unsigned int consumed = nes_atomic_load(&pipe->consumed);
+    if (published - consumed >= 2) {
+        return NULL;
+    }
+    return &pipe->frames[published & 1];
+}
+
+void nes_ppu_pipe_publish(nes_ppu_pipe_t *pipe) {
+    nes_atomic_store(&pipe->published, nes_atomic_load(&pipe->published) + 1);
+}
+
+const nes_ppu_frame_t *nes_ppu_pipe_front(nes_ppu_pipe_t *pipe) {
+    unsigned int consumed = nes_atomic_load(&pipe->consumed);
+    if (nes_atomic_load(&pipe->published) == consumed) {
+        return NULL;
+    }
+    return &pipe->frames[consumed & 1];
+}
+
+void nes_ppu_pipe_release(nes_ppu_pipe_t *pipe) {
+    nes_atomic_store(&pipe->consumed, nes_atomic_load(&pipe->consumed) + 1);
+}
@@ -3,10 +3,58 @@
 
 #include <stdint.h>
 #include "nes.h"
+#include "nes_atomic.h"
+
+typedef struct {
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t scroll_x;
+    uint8_t scroll_y;
+    uint8_t oam[NES_OAM_SIZE];
+    uint8_t nametable[NES_NAMETABLE_SIZE];
+    uint16_t nametable_page[4];
+    uint8_t palette[NES_PALETTE_SIZE];
+} nes_ppu_frame_t;
+
+/* Double-buffered frame handoff: the emulation side captures into the back
+ * slot while the renderer draws the front one. */
+typedef struct {
+    nes_ppu_frame_t frames[2];
+    nes_atomic_t published;
+    nes_atomic_t consumed;
+} nes_ppu_pipe_t;
 
 void nes_ppu_reset(nes_t *nes);
+void nes_ppu_set_mirroring(nes_t *nes, nes_mirroring_t mirroring);
 void nes_ppu_render_frame(nes_t *nes);
+void nes_ppu_start_frame(nes_t *nes, uint32_t frame_time);
+void nes_ppu_vblank(nes_t *nes);
+void nes_ppu_capture(const nes_t *nes, nes_ppu_frame_t *frame);
+void nes_ppu_draw(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer);
+void nes_ppu_draw_background(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer);
+void nes_ppu_draw_sprites(const nes_ppu_frame_t *frame, const uint8_t *chr, uint8_t *buffer);
+void nes_ppu_tile_row(uint8_t *dst, uint8_t plane0, uint8_t plane1, const uint8_t *colors);
+void nes_ppu_sprite_row(uint8_t *dst, uint8_t plane0, uint8_t plane1, const uint8_t *colors);
+uint64_t nes_ppu_frame_hash(const uint8_t *buffer);
 uint8_t nes_ppu_read_data(nes_t *nes);
 void nes_ppu_write_data(nes_t *nes, uint8_t value);
 
+/* ASM=YES draws with the eZ80 versions in nes_ppu_kernels.asm; the C
+ * kernels above stay as the reference they are checked against. */
+#ifdef NES_ASM
+void nes_ppu_tile_row_asm(uint8_t *dst, uint8_t plane0, uint8_t plane1, const uint8_t *colors);
+void nes_ppu_sprite_row_asm(uint8_t *dst, uint8_t plane0, uint8_t plane1, const uint8_t *colors);
+#define NES_PPU_TILE_ROW nes_ppu_tile_row_asm
+#define NES_PPU_SPRITE_ROW nes_ppu_sprite_row_asm
+#else
+#define NES_PPU_TILE_ROW nes_ppu_tile_row
+#define NES_PPU_SPRITE_ROW nes_ppu_sprite_row
+#endif
+
+void nes_ppu_pipe_init(nes_ppu_pipe_t *pipe);
+nes_ppu_frame_t *nes_ppu_pipe_back(nes_ppu_pipe_t *pipe);
+void nes_ppu_pipe_publish(nes_ppu_pipe_t *pipe);
+const nes_ppu_frame_t *nes_ppu_pipe_front(nes_ppu_pipe_t *pipe);
+void nes_ppu_pipe_release(nes_ppu_pipe_t *pipe);
+
 #endif
@@ -0,0 +1,107 @@
+; eZ80 versions of nes_ppu_tile_row and nes_ppu_sprite_row, used when the
+; game is built with ASM=YES. They take the same arguments as the C kernels:
+;
+;   dst     pointer to the first of eight output pixels
+;   plane0  low pattern plane, leftmost pixel in bit 7
+;   plane1  high pattern plane
+;   colors  four output colors, indexed by plane1 << 1 | plane0
+;
+; The four colors live in d, e, h and l and dst in iy, so each pixel is two
+; shifts, two branches and one indexed store with a constant offset.
+
+	assume	adl=1
+
+	section	.text
+
+	public	_nes_ppu_tile_row_asm
+	public	_nes_ppu_sprite_row_asm
+
+macro load_args
+	push	iy
+	ld	iy, 0
+	add	iy, sp
+	ld	c, (iy + 9)
+	ld	b, (iy + 12)
+	ld	hl, (iy + 15)
+	ld	iy, (iy + 6)
+	ld	d, (hl)
+	inc	hl
+	ld	e, (hl)
+	inc	hl
+	ld	a, (hl)
+	inc	hl
+	ld	l, (hl)
+	ld	h, a
+end macro
+
+macro tile_pixel offset
+	local high, store
+	sla	b
+	jr	c, high
+	sla	c
+	ld	a, d
+	jr	nc, store
+	ld	a, e
+	jr	store
+high:
+	sla	c
+	ld	a, h
+	jr	nc, store
+	ld	a, l
+store:
+	ld	(iy + offset), a
+end macro
+
+macro sprite_pixel offset
+	local high, three, skip
+	sla	b
+	jr	c, high
+	sla	c
+	jr	nc, skip
+	ld	(iy + offset), e
+	jr	skip
+high:
+	sla	c
+	jr	c, three
+	ld	(iy + offset), h
+	jr	skip
+three:
+	ld	(iy + offset), l
+skip:
+end macro
+
+_nes_ppu_tile_row_asm:
+	load_args
+	tile_pixel 0
+	tile_pixel 1
+	tile_pixel 2
+	tile_pixel 3
+	tile_pixel 4
+	tile_pixel 5
+	tile_pixel 6
+	tile_pixel 7
+	pop	iy
+	ret
+
+; Fully transparent rows, including ones masked off the right edge, return
+; before any colors are loaded.
+_nes_ppu_sprite_row_asm:
+	ld	hl, 6
+	add	hl, sp
+	ld	a, (hl)
+	inc	hl
+	inc	hl
+	inc	hl
+	or	a, (hl)
+	ret	z
+	load_args
+	sprite_pixel 0
+	sprite_pixel 1
+	sprite_pixel 2
+	sprite_pixel 3
+	sprite_pixel 4
+	sprite_pixel 5
+	sprite_pixel 6
+	sprite_pixel 7
+	pop	iy
+	ret
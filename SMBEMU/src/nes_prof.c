@@ -0,0 +1,263 @@
+#include "nes_prof.h"
+
+#ifdef NES_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_opcodes.h"
+
+typedef struct {
+    uint32_t count;
+    uint32_t cycles;
+} prof_counter_t;
+
+static prof_counter_t opcode_stats[256];
+static uint32_t bus_reads[NES_BUS_REGION_COUNT];
+static uint32_t bus_writes[NES_BUS_REGION_COUNT];
+#ifdef NES_PROFILE_PC
+static uint32_t pc_counts[NES_PROFILE_PC_SIZE];
+#endif
+
+static const char *const region_names[NES_BUS_REGION_COUNT] = {
+    "ram", "ppu", "4016", "prg", "other"
+};
+
+static nes_bus_region_t bus_region(uint16_t addr) {
+    if (addr < 0x2000) {
+        return NES_BUS_RAM;
+    }
+    if (addr < 0x4000) {
+        return NES_BUS_PPU;
+    }
+    if (addr == 0x4016) {
+        return NES_BUS_INPUT;
+    }
+    if (addr >= 0x8000) {
+        return NES_BUS_PRG;
+    }
+    return NES_BUS_OTHER;
+}
+
+void nes_prof_reset(void) {
+    memset(opcode_stats, 0, sizeof(opcode_stats));
+    memset(bus_reads, 0, sizeof(bus_reads));
+    memset(bus_writes, 0, sizeof(bus_writes));
+#ifdef NES_PROFILE_PC
+    memset(pc_counts, 0, sizeof(pc_counts));
+#endif
+}
+
+void nes_prof_insn(uint16_t pc, uint8_t opcode, int cycles) {
+    opcode_stats[opcode].count++;
+    opcode_stats[opcode].cycles += (uint32_t)cycles;
+#ifdef NES_PROFILE_PC
+    if ((uint16_t)(pc - NES_PROFILE_PC_START) < NES_PROFILE_PC_SIZE) {
+        pc_counts[pc - NES_PROFILE_PC_START]++;
+    }
+#else
+    (void)pc;
+#endif
+}
+
+void nes_prof_bus(uint16_t addr, bool write) {
+    if (write) {
+        bus_writes[bus_region(addr)]++;
+    } else {
+        bus_reads[bus_region(addr)]++;
+    }
+}
+
+static int compare_opcodes(const void *a, const void *b) {
+    uint32_t ca = opcode_stats[*(const uint8_t *)a].cycles;
+    uint32_t cb = opcode_stats[*(const uint8_t *)b].cycles;
+    return (ca < cb) - (ca > cb);
+}
+
+#ifdef NES_PROFILE_PC
+static bool parse_hex(const char **cursor, const char *end, uint32_t *value) {
+    const char *p = *cursor;
+    uint32_t result = 0;
+    int digits = 0;
+    while (p < end) {
+        char c = *p;
+        int nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else {
+            break;
+        }
+        result = (result << 4) | (uint32_t)nibble;
+        digits++;
+        p++;
+    }
+    *cursor = p;
+    *value = result;
+    return digits > 0;
+}
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+static const char *skip_word(const char *p, const char *end) {
+    while (p < end && *p != ' ' && *p != '\t' && *p != '=' && *p != '\r') {
+        p++;
+    }
+    return p;
+}
+
+/* Accepts ld65 VICE label lines ("al 00C000 .Name") and assignments
+ * ("Name = $C000"). */
+static bool parse_label(const char *line, const char *end, uint16_t *addr, const char **name, int *name_len) {
+    const char *p = skip_spaces(line, end);
+    uint32_t value;
+    if (end - p > 3 && p[0] == 'a' && p[1] == 'l' && p[2] == ' ') {
+        p = skip_spaces(p + 3, end);
+        if (!parse_hex(&p, end, &value)) {
+            return false;
+        }
+        p = skip_spaces(p, end);
+        if (p < end && *p == '.') {
+            p++;
+        }
+        *name = p;
+        *name_len = (int)(skip_word(p, end) - p);
+    } else {
+        *name = p;
+        p = skip_word(p, end);
+        *name_len = (int)(p - *name);
+        p = skip_spaces(p, end);
+        if (p >= end || *p != '=') {
+            return false;
+        }
+        p = skip_spaces(p + 1, end);
+        if (p >= end || *p != '$') {
+            return false;
+        }
+        p++;
+        if (!parse_hex(&p, end, &value)) {
+            return false;
+        }
+    }
+    if (*name_len == 0 || value > 0xFFFF) {
+        return false;
+    }
+    *addr = (uint16_t)value;
+    return true;
+}
+
+static void symbolise(uint16_t pc, const char *labels, size_t labels_size, char *out, size_t out_size) {
+    const char *best = NULL;
+    int best_len = 0;
+    uint16_t best_addr = 0;
+    const char *p = labels;
+    const char *end = labels + labels_size;
+    while (p < end) {
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        if (!line_end) {
+            line_end = end;
+        }
+        uint16_t addr;
+        const char *name;
+        int name_len;
+        if (parse_label(p, line_end, &addr, &name, &name_len) && addr <= pc && addr >= 0x8000 &&
+            (!best || addr > best_addr)) {
+            best = name;
+            best_len = name_len;
+            best_addr = addr;
+        }
+        p = line_end + 1;
+    }
+    if (!best) {
+        out[0] = '\0';
+    } else if (best_addr == pc) {
+        snprintf(out, out_size, "%.*s", best_len, best);
+    } else {
+        snprintf(out, out_size, "%.*s+%u", best_len, best, (unsigned int)(pc - best_addr));
+    }
+}
+
+static void report_pcs(nes_report_fn emit, void *ctx, const char *labels, size_t labels_size) {
+    static uint16_t top[NES_PROF_TOP_PCS];
+    int used = 0;
+    char line[96];
+    char symbol[48];
+    for (uint16_t i = 0; i < NES_PROFILE_PC_SIZE; i++) {
+        uint32_t count = pc_counts[i];
+        if (!count || (used == NES_PROF_TOP_PCS && count <= pc_counts[top[used - 1]])) {
+            continue;
+        }
+        int slot = used < NES_PROF_TOP_PCS ? used++ : used - 1;
+        while (slot > 0 && pc_counts[top[slot - 1]] < count) {
+            top[slot] = top[slot - 1];
+            slot--;
+        }
+        top[slot] = i;
+    }
+    emit(ctx, "# pc count label");
+    for (int i = 0; i < used; i++) {
+        uint16_t pc = (uint16_t)(top[i] + NES_PROFILE_PC_START);
+        symbol[0] = '\0';
+        if (labels) {
+            symbolise(pc, labels, labels_size, symbol, sizeof(symbol));
+        }
+        snprintf(line, sizeof(line), "%04X %lu %s", (unsigned int)pc,
+                 (unsigned long)pc_counts[top[i]], symbol);
+        emit(ctx, line);
+    }
+}
+#endif
+
+/* Emits one line per call, hottest entries first. labels may be NULL. */
+void nes_prof_report(nes_report_fn emit, void *ctx, const char *labels, size_t labels_size) {
+    static uint8_t order[256];
+    prof_counter_t modes[NES_MODE_COUNT];
+    char line[96];
+
+    memset(modes, 0, sizeof(modes));
+    for (int i = 0; i < 256; i++) {
+        order[i] = (uint8_t)i;
+        modes[nes_opcode_modes[i]].count += opcode_stats[i].count;
+        modes[nes_opcode_modes[i]].cycles += opcode_stats[i].cycles;
+    }
+    qsort(order, 256, 1, compare_opcodes);
+
+    emit(ctx, "# opcode name mode count cycles");
+    for (int i = 0; i < 256 && opcode_stats[order[i]].count; i++) {
+        uint8_t op = order[i];
+        snprintf(line, sizeof(line), "%02X %s %s %lu %lu", (unsigned int)op,
+                 nes_opcode_names[op], nes_mode_names[nes_opcode_modes[op]],
+                 (unsigned long)opcode_stats[op].count, (unsigned long)opcode_stats[op].cycles);
+        emit(ctx, line);
+    }
+    emit(ctx, "# mode count cycles");
+    for (int i = 0; i < NES_MODE_COUNT; i++) {
+        snprintf(line, sizeof(line), "%s %lu %lu", nes_mode_names[i],
+                 (unsigned long)modes[i].count, (unsigned long)modes[i].cycles);
+        emit(ctx, line);
+    }
+    emit(ctx, "# region reads writes");
+    for (int i = 0; i < NES_BUS_REGION_COUNT; i++) {
+        snprintf(line, sizeof(line), "%s %lu %lu", region_names[i],
+                 (unsigned long)bus_reads[i], (unsigned long)bus_writes[i]);
+        emit(ctx, line);
+    }
+#ifdef NES_PROFILE_PC
+    report_pcs(emit, ctx, labels, labels_size);
+#else
+    (void)labels;
+    (void)labels_size;
+#endif
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef NES_PROF_H
+#define NES_PROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NES_PROF_TOP_PCS 64
+
+typedef void (*nes_report_fn)(void *ctx, const char *line);
+
+/* Profiling hooks compile to nothing unless NES_PROFILE is defined. Per-PC
+ * counters are further gated by NES_PROFILE_PC and cover only the
+ * NES_PROFILE_PC_SIZE addresses from NES_PROFILE_PC_START, four bytes each;
+ * the default 4 KB window takes 16 KB, where all of PRG would take 128 KB. */
+#ifdef NES_PROFILE_PC
+#ifndef NES_PROFILE_PC_START
+#define NES_PROFILE_PC_START 0x8000
+#endif
+#ifndef NES_PROFILE_PC_SIZE
+#define NES_PROFILE_PC_SIZE 0x1000
+#endif
+#if NES_PROFILE_PC_START < 0x8000 || NES_PROFILE_PC_START + NES_PROFILE_PC_SIZE > 0x10000
+#error "NES_PROFILE_PC_START and NES_PROFILE_PC_SIZE must stay within $8000-$FFFF"
+#endif
+#endif
+#ifdef NES_PROFILE
+void nes_prof_reset(void);
+void nes_prof_insn(uint16_t pc, uint8_t opcode, int cycles);
+void nes_prof_bus(uint16_t addr, bool write);
+void nes_prof_report(nes_report_fn emit, void *ctx, const char *labels, size_t labels_size);
+#define NES_PROF_INSN(pc, opcode, cycles) nes_prof_insn((pc), (opcode), (cycles))
+#define NES_PROF_BUS(addr, write) nes_prof_bus((addr), (write))
+#else
+#define NES_PROF_INSN(pc, opcode, cycles) ((void)0)
+#define NES_PROF_BUS(addr, write) ((void)0)
+#endif
+
+#endif
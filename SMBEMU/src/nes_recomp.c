@@ -0,0 +1,29 @@
+#include "nes_recomp.h"
+
+#ifdef NES_RECOMP
+
+#include <stddef.h>
+
+/* The bitmap rejects interpreted pcs without touching the block table. */
+nes_block_fn nes_recomp_lookup(uint16_t pc) {
+    if (pc < 0x8000) {
+        return NULL;
+    }
+    uint16_t offset = pc - 0x8000;
+    if (!(nes_recomp_starts[offset >> 3] & (1 << (offset & 7)))) {
+        return NULL;
+    }
+    uint16_t lo = 0;
+    uint16_t hi = nes_recomp_block_count;
+    while (lo < hi) {
+        uint16_t mid = (uint16_t)((lo + hi) / 2);
+        if (nes_recomp_blocks[mid].pc < pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return nes_recomp_blocks[lo].run;
+}
+
+#endif
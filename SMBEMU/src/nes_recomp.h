@@ -0,0 +1,92 @@
+#ifndef NES_RECOMP_H
+#define NES_RECOMP_H
+
+#include <stdint.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_apu.h"
+
+/* A recompiled basic block. It runs from its start address until it leaves
+ * straight-line code or sched.now reaches deadline, charging the same
+ * cycles as the interpreter, and leaves cpu->pc at the next instruction. */
+typedef void (*nes_block_fn)(nes_t *nes, uint32_t deadline);
+
+typedef struct {
+    uint16_t pc;
+    nes_block_fn run;
+} nes_block_t;
+
+#ifdef NES_RECOMP
+/* Emitted by tools/recomp.c into nes_recomp_gen.c, sorted by pc; starts is
+ * a bitmap over $8000-$FFFF of the pcs that have a block. */
+extern const nes_block_t nes_recomp_blocks[];
+extern const uint16_t nes_recomp_block_count;
+extern const uint8_t nes_recomp_starts[0x1000];
+
+nes_block_fn nes_recomp_lookup(uint16_t pc);
+#endif
+
+/* Building blocks for generated code. Each expects nes, cpu and deadline in
+ * scope and mirrors the matching interpreter case in nes_cpu.c. Arguments
+ * that are evaluated twice are always registers or RAM lvalues. */
+#define R_CYCLES(n) (nes->sched.now += (n))
+#define R_EXIT(next) do { cpu->pc = (next); return; } while (0)
+#define R_CHECK(next) do { if ((int32_t)(nes->sched.now - deadline) >= 0) R_EXIT(next); } while (0)
+/* After CLI, PLP and RTI: end the block and the slice if an APU IRQ is now
+ * unmasked, as unmask() does in the interpreter. */
+#define R_UNMASK(next) do { \
+        if (nes_apu_irq(nes) && !(cpu->p & FLAG_I)) { \
+            nes->sched.deadline = nes->sched.now; \
+            R_EXIT(next); \
+        } \
+    } while (0)
+
+#define R_ZN(v) (cpu->p = (uint8_t)((cpu->p & ~(FLAG_Z | FLAG_N)) | ((v) ? 0 : FLAG_Z) | ((v) & FLAG_N)))
+#define R_PUSH(v) (nes->ram[0x0100 | cpu->sp--] = (v))
+#define R_POP() (nes->ram[0x0100 | ++cpu->sp])
+#define R_IZX(zp) (uint16_t)(nes->ram[(uint8_t)((zp) + cpu->x)] | nes->ram[(uint8_t)((zp) + cpu->x + 1)] << 8)
+#define R_IZY(zp) (uint16_t)((nes->ram[(zp)] | nes->ram[(uint8_t)((zp) + 1)] << 8) + cpu->y)
+/* 1 when an indexed read carries into the high byte (page_cross in nes_cpu.c). */
+#define R_CROSS(lo, index) ((lo) + (index) > 0xFF)
+
+#define R_ADC(v) do { \
+        uint8_t r_v = (v); \
+        uint16_t r_sum = (uint16_t)(cpu->a + r_v + (cpu->p & FLAG_C)); \
+        uint8_t r_res = (uint8_t)r_sum; \
+        cpu->p = (uint8_t)((cpu->p & ~(FLAG_C | FLAG_V)) | (r_sum > 0xFF ? FLAG_C : 0) | \
+                           (((cpu->a ^ r_res) & (r_v ^ r_res) & 0x80) ? FLAG_V : 0)); \
+        cpu->a = r_res; \
+        R_ZN(cpu->a); \
+    } while (0)
+#define R_SBC(v) R_ADC((uint8_t)~(v))
+#define R_CMP(reg, v) do { \
+        uint8_t r_v = (v); \
+        uint8_t r_res = (uint8_t)((reg) - r_v); \
+        cpu->p = (uint8_t)((cpu->p & ~(FLAG_C | FLAG_Z | FLAG_N)) | ((reg) >= r_v ? FLAG_C : 0) | \
+                           (r_res ? 0 : FLAG_Z) | (r_res & FLAG_N)); \
+    } while (0)
+#define R_BIT(v) do { \
+        uint8_t r_v = (v); \
+        cpu->p = (uint8_t)((cpu->p & ~(FLAG_Z | FLAG_N | FLAG_V)) | (r_v & (FLAG_N | FLAG_V)) | \
+                           ((cpu->a & r_v) ? 0 : FLAG_Z)); \
+    } while (0)
+
+/* Read-modify-write operations on an lvalue. */
+#define R_ASL(m) do { cpu->p = (uint8_t)((cpu->p & ~FLAG_C) | ((m) >> 7)); (m) = (uint8_t)((m) << 1); R_ZN(m); } while (0)
+#define R_LSR(m) do { cpu->p = (uint8_t)((cpu->p & ~FLAG_C) | ((m) & 1)); (m) >>= 1; R_ZN(m); } while (0)
+#define R_ROL(m) do { \
+        uint8_t r_c = cpu->p & FLAG_C; \
+        cpu->p = (uint8_t)((cpu->p & ~FLAG_C) | ((m) >> 7)); \
+        (m) = (uint8_t)((m) << 1 | r_c); \
+        R_ZN(m); \
+    } while (0)
+#define R_ROR(m) do { \
+        uint8_t r_c = cpu->p & FLAG_C; \
+        cpu->p = (uint8_t)((cpu->p & ~FLAG_C) | ((m) & 1)); \
+        (m) = (uint8_t)((m) >> 1 | r_c << 7); \
+        R_ZN(m); \
+    } while (0)
+#define R_INC(m) do { (m) = (uint8_t)((m) + 1); R_ZN(m); } while (0)
+#define R_DEC(m) do { (m) = (uint8_t)((m) - 1); R_ZN(m); } while (0)
+
+#endif
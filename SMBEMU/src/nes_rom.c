@@ -0,0 +1,189 @@
+#include "nes_rom.h"
+#include <string.h>
+
+/* parse_packed decodes PRG and CHR as one run of bytes. */
+typedef char banks_are_contiguous[sizeof(nes_rom_banks_t) == NES_PRG_SIZE + NES_CHR_SIZE ? 1 : -1];
+
+/* Checks an iNES header and returns the PRG size, or 0. */
+static size_t check_header(const uint8_t *header, const char **error) {
+    if (memcmp(header, "NES\x1A", 4) != 0) {
+        *error = "Bad iNES magic";
+        return 0;
+    }
+    if ((header[4] != 1 && header[4] != 2) || header[5] != 1) {
+        *error = "Unsupported ROM size";
+        return 0;
+    }
+    if (((header[7] & 0xF0) | (header[6] >> 4)) != 0) {
+        *error = "Unsupported mapper";
+        return 0;
+    }
+    if (header[6] & 0x08) {
+        *error = "Four-screen VRAM not supported";
+        return 0;
+    }
+    return (size_t)header[4] * 0x4000u;
+}
+
+static void set_mirroring(nes_rom_t *rom, uint8_t flags6) {
+    rom->mirroring = (flags6 & 0x01) ? NES_MIRROR_VERTICAL : NES_MIRROR_HORIZONTAL;
+}
+
+/* Reads a length that continues in 255-valued bytes, as LZ4 does. */
+static bool extend_length(const uint8_t **in, const uint8_t *in_end, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*in >= in_end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/* Decodes an LZ4 block straight into dst, which it fills exactly. Each
+ * sequence is a token, literals, a 16-bit offset and a match; the last
+ * one ends after its literals. Literals and non-overlapping matches are
+ * memcpy, which the CE toolchain turns into LDIR, and only short-offset
+ * runs are copied a byte at a time. Every length and offset is checked,
+ * so a damaged AppVar fails to load rather than writing past dst. */
+static bool unpack(const uint8_t *in, size_t in_size, uint8_t *dst, size_t dst_size) {
+    const uint8_t *in_end = in + in_size;
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + dst_size;
+    for (;;) {
+        if (in >= in_end) {
+            return false;
+        }
+        uint8_t token = *in++;
+        size_t length = token >> 4;
+        if (length == 15 && !extend_length(&in, in_end, &length)) {
+            return false;
+        }
+        if (length > (size_t)(in_end - in) || length > (size_t)(out_end - out)) {
+            return false;
+        }
+        memcpy(out, in, length);
+        out += length;
+        in += length;
+        if (out == out_end) {
+            return true;
+        }
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = (size_t)in[0] | (size_t)in[1] << 8;
+        in += 2;
+        length = (size_t)(token & 15) + 4;
+        if ((token & 15) == 15 && !extend_length(&in, in_end, &length)) {
+            return false;
+        }
+        if (offset == 0 || offset > (size_t)(out - dst) || length > (size_t)(out_end - out)) {
+            return false;
+        }
+        const uint8_t *match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+            out += length;
+        } else {
+            while (length--) {
+                *out++ = *match++;
+            }
+        }
+    }
+}
+
+/* A compressed image is NES_ROM_PACKED_MAGIC, the original iNES header and
+ * PRG followed by CHR as one LZ4 block (see tools/romz.c). The block is
+ * decoded straight into banks, which are laid out PRG then CHR: a 32 KB
+ * PRG fills them exactly, and a 16 KB one is decoded into the upper half
+ * of PRG and then mirrored down. */
+static bool parse_packed(nes_rom_t *rom, const uint8_t *image, size_t size, nes_rom_banks_t *banks,
+                         const char **error) {
+    const uint8_t *header = image + NES_ROM_PACKED_MAGIC_SIZE;
+    if (size < NES_ROM_PACKED_MAGIC_SIZE + NES_ROM_HEADER_SIZE) {
+        *error = "ROM file truncated";
+        return false;
+    }
+    size_t prg_size = check_header(header, error);
+    if (!prg_size) {
+        return false;
+    }
+    if (!banks) {
+        *error = "Compressed ROM must be copied";
+        return false;
+    }
+    uint8_t *dst = (uint8_t *)banks + (NES_PRG_SIZE - prg_size);
+    const uint8_t *block = header + NES_ROM_HEADER_SIZE;
+    if (!unpack(block, size - (size_t)(block - image), dst, prg_size + NES_CHR_SIZE)) {
+        *error = "Compressed ROM is damaged";
+        return false;
+    }
+    if (prg_size < NES_PRG_SIZE) {
+        memcpy(banks->prg, dst, prg_size);
+    }
+    rom->prg = banks->prg;
+    rom->chr = banks->chr;
+    set_mirroring(rom, header[6]);
+    return true;
+}
+
+/* Sets rom up from an iNES image in memory, or a compressed one. With
+ * banks, PRG and CHR are copied or decoded there and a 16 KB PRG is
+ * mirrored; without, they are referenced in place, which needs an
+ * uncompressed 32 KB PRG. Either way the image must stay valid for as long
+ * as it is referenced. rom starts with one reference and no release
+ * function. */
+bool nes_rom_parse(nes_rom_t *rom, const uint8_t *image, size_t size, nes_rom_banks_t *banks,
+                   const char **error) {
+    *error = NULL;
+    nes_atomic_store(&rom->refs, 1);
+    rom->release = NULL;
+    if (size >= NES_ROM_PACKED_MAGIC_SIZE &&
+        memcmp(image, NES_ROM_PACKED_MAGIC, NES_ROM_PACKED_MAGIC_SIZE) == 0) {
+        return parse_packed(rom, image, size, banks, error);
+    }
+    if (size < NES_ROM_HEADER_SIZE) {
+        *error = "ROM file truncated";
+        return false;
+    }
+    size_t prg_size = check_header(image, error);
+    if (!prg_size) {
+        return false;
+    }
+    size_t offset = NES_ROM_HEADER_SIZE + ((image[6] & 0x04) ? 512 : 0);
+    if (size < offset + prg_size + NES_CHR_SIZE) {
+        *error = "ROM file truncated";
+        return false;
+    }
+    const uint8_t *prg = image + offset;
+    const uint8_t *chr = prg + prg_size;
+    if (banks) {
+        memcpy(banks->prg, prg, prg_size);
+        if (prg_size < NES_PRG_SIZE) {
+            memcpy(banks->prg + prg_size, prg, prg_size);
+        }
+        memcpy(banks->chr, chr, NES_CHR_SIZE);
+        prg = banks->prg;
+        chr = banks->chr;
+    } else if (prg_size < NES_PRG_SIZE) {
+        *error = "16 KB PRG must be copied";
+        return false;
+    }
+    rom->prg = prg;
+    rom->chr = chr;
+    set_mirroring(rom, image[6]);
+    return true;
+}
+
+void nes_rom_retain(nes_rom_t *rom) {
+    (void)nes_atomic_add(&rom->refs, 1u);
+}
+
+/* The last release hands the image back to whoever loaded it. */
+void nes_rom_release(nes_rom_t *rom) {
+    if (nes_atomic_add(&rom->refs, ~0u) == 1 && rom->release) {
+        rom->release(rom);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef NES_ROM_H
+#define NES_ROM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nes.h"
+
+#define NES_ROM_HEADER_SIZE 16
+
+/* Leads a compressed image, in place of the iNES magic. */
+#define NES_ROM_PACKED_MAGIC "NESZ"
+#define NES_ROM_PACKED_MAGIC_SIZE 4
+
+bool nes_rom_parse(nes_rom_t *rom, const uint8_t *image, size_t size, nes_rom_banks_t *banks,
+                   const char **error);
+void nes_rom_retain(nes_rom_t *rom);
+void nes_rom_release(nes_rom_t *rom);
+
+#endif
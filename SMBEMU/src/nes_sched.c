@@ -0,0 +1,82 @@
+#include "nes_sched.h"
+#include "nes_ppu.h"
+#include "nes_apu.h"
+
+/* Events are kept sorted by timestamp, soonest first. Times are absolute CPU
+ * cycles and are compared through signed differences so they may wrap. */
+
+static bool before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+void nes_sched_reset(nes_t *nes) {
+    nes_sched_t *sched = &nes->sched;
+    sched->now = 0;
+    sched->target = 0;
+    sched->deadline = 0;
+    sched->count = 0;
+}
+
+void nes_sched_cancel(nes_t *nes, nes_event_kind_t kind) {
+    nes_sched_t *sched = &nes->sched;
+    for (uint8_t i = 0; i < sched->count; i++) {
+        if (sched->events[i].kind == kind) {
+            for (uint8_t j = i + 1; j < sched->count; j++) {
+                sched->events[j - 1] = sched->events[j];
+            }
+            sched->count--;
+            return;
+        }
+    }
+}
+
+void nes_sched_add(nes_t *nes, nes_event_kind_t kind, uint32_t time) {
+    nes_sched_t *sched = &nes->sched;
+    nes_sched_cancel(nes, kind);
+    if (sched->count >= NES_MAX_EVENTS) {
+        return;
+    }
+    uint8_t i = sched->count;
+    while (i > 0 && before(time, sched->events[i - 1].time)) {
+        sched->events[i] = sched->events[i - 1];
+        i--;
+    }
+    sched->events[i].time = time;
+    sched->events[i].kind = (uint8_t)kind;
+    sched->count++;
+}
+
+uint32_t nes_sched_deadline(const nes_t *nes, uint32_t limit) {
+    const nes_sched_t *sched = &nes->sched;
+    if (sched->count && before(sched->events[0].time, limit)) {
+        return sched->events[0].time;
+    }
+    return limit;
+}
+
+void nes_sched_dispatch(nes_t *nes) {
+    nes_sched_t *sched = &nes->sched;
+    while (sched->count && !before(sched->now, sched->events[0].time)) {
+        nes_event_t event = sched->events[0];
+        for (uint8_t i = 1; i < sched->count; i++) {
+            sched->events[i - 1] = sched->events[i];
+        }
+        sched->count--;
+        switch (event.kind) {
+        case NES_EVENT_FRAME_START:
+            nes_ppu_start_frame(nes, event.time);
+            break;
+        case NES_EVENT_SPRITE0:
+            nes->ppu.status |= 0x40;
+            break;
+        case NES_EVENT_VBLANK:
+            nes_ppu_vblank(nes);
+            break;
+        case NES_EVENT_APU:
+            nes_apu_event(nes);
+            break;
+        default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef NES_SCHED_H
+#define NES_SCHED_H
+
+#include <stdint.h>
+#include "nes.h"
+
+void nes_sched_reset(nes_t *nes);
+void nes_sched_add(nes_t *nes, nes_event_kind_t kind, uint32_t time);
+void nes_sched_cancel(nes_t *nes, nes_event_kind_t kind);
+uint32_t nes_sched_deadline(const nes_t *nes, uint32_t limit);
+void nes_sched_dispatch(nes_t *nes);
+
+#endif
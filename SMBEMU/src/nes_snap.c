@@ -0,0 +1,54 @@
+#include "nes_snap.h"
+#include <string.h>
+
+#define NES_SNAP_MAGIC 0x50414E53u
+#define NES_SNAP_VERSION 2
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t *p, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 0x01000193u;
+    }
+    return hash;
+}
+
+/* FNV-1a over PRG, CHR and the mirroring, the bytes a snapshot depends on
+ * wherever the banks are stored. */
+uint32_t nes_rom_hash(const nes_rom_t *rom) {
+    uint32_t hash = fnv1a(0x811C9DC5u, rom->prg, NES_PRG_SIZE);
+    hash = fnv1a(hash, rom->chr, NES_CHR_SIZE);
+    return fnv1a(hash, &rom->mirroring, 1);
+}
+
+void nes_snap_header(nes_snap_header_t *header, uint32_t rom_hash) {
+    header->magic = NES_SNAP_MAGIC;
+    header->version = NES_SNAP_VERSION;
+    header->state_size = (uint16_t)sizeof(nes_t);
+    header->rom_hash = rom_hash;
+}
+
+/* Loads emulated state from data, which may be unaligned. The ROM mapping,
+ * audio buffer and input provider belong to the running instance and are
+ * kept. */
+bool nes_snap_restore(nes_t *nes, uint32_t rom_hash, const void *data, size_t size) {
+    nes_snap_header_t header;
+    if (size < sizeof(header) + sizeof(*nes)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != NES_SNAP_MAGIC || header.version != NES_SNAP_VERSION ||
+        header.state_size != sizeof(*nes) || header.rom_hash != rom_hash) {
+        return false;
+    }
+    const uint8_t *prg = nes->prg;
+    const uint8_t *chr = nes->chr;
+    nes_input_fn provider = nes->input_provider;
+    void *ctx = nes->input_ctx;
+    struct nes_apu_buffer *audio = nes->audio;
+    memcpy(nes, (const uint8_t *)data + sizeof(header), sizeof(*nes));
+    nes->prg = prg;
+    nes->chr = chr;
+    nes->input_provider = provider;
+    nes->input_ctx = ctx;
+    nes->audio = audio;
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef NES_SNAP_H
+#define NES_SNAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nes.h"
+
+/* A snapshot is this header followed by the raw nes_t. It only loads into
+ * the build and ROM that wrote it. */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t state_size;
+    uint32_t rom_hash;
+} nes_snap_header_t;
+
+uint32_t nes_rom_hash(const nes_rom_t *rom);
+void nes_snap_header(nes_snap_header_t *header, uint32_t rom_hash);
+bool nes_snap_restore(nes_t *nes, uint32_t rom_hash, const void *data, size_t size);
+
+#endif
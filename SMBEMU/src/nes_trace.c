@@ -0,0 +1,191 @@
+#include "nes_trace.h"
+
+#ifdef NES_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static nes_trace_t *active;
+
+typedef struct {
+    uint16_t pc;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t sp;
+    uint32_t cycles;
+} trace_row_t;
+
+static const char *find_field(const char *line, const char *end, const char *key) {
+    size_t key_len = strlen(key);
+    for (const char *p = line; p + key_len <= end; p++) {
+        if (memcmp(p, key, key_len) == 0 && (p == line || p[-1] == ' ')) {
+            return p + key_len;
+        }
+    }
+    return NULL;
+}
+
+static bool read_hex(const char *p, const char *end, int digits, uint32_t *value) {
+    uint32_t result = 0;
+    for (int i = 0; i < digits; i++) {
+        if (!p || p + i >= end) {
+            return false;
+        }
+        char c = p[i];
+        int nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        result = (result << 4) | (uint32_t)nibble;
+    }
+    *value = result;
+    return true;
+}
+
+static bool parse_row(const char *line, const char *end, trace_row_t *row) {
+    uint32_t pc, a, x, y, p, sp;
+    const char *cyc = find_field(line, end, "CYC:");
+    if (!read_hex(line, end, 4, &pc) ||
+        !read_hex(find_field(line, end, "A:"), end, 2, &a) ||
+        !read_hex(find_field(line, end, "X:"), end, 2, &x) ||
+        !read_hex(find_field(line, end, "Y:"), end, 2, &y) ||
+        !read_hex(find_field(line, end, "P:"), end, 2, &p) ||
+        !read_hex(find_field(line, end, "SP:"), end, 2, &sp) || !cyc) {
+        return false;
+    }
+    row->pc = (uint16_t)pc;
+    row->a = (uint8_t)a;
+    row->x = (uint8_t)x;
+    row->y = (uint8_t)y;
+    row->p = (uint8_t)p;
+    row->sp = (uint8_t)sp;
+    row->cycles = (uint32_t)strtoul(cyc, NULL, 10);
+    return true;
+}
+
+/* Returns the next line of the reference log, or false at its end. */
+static bool next_ref_line(nes_trace_t *trace, const char **line, const char **end) {
+    while (trace->ref_pos < trace->ref_size) {
+        const char *start = trace->ref + trace->ref_pos;
+        const char *stop = memchr(start, '\n', trace->ref_size - trace->ref_pos);
+        if (!stop) {
+            stop = trace->ref + trace->ref_size;
+        }
+        trace->ref_pos = (size_t)(stop - trace->ref) + 1;
+        if (stop > start) {
+            *line = start;
+            *end = (stop[-1] == '\r') ? stop - 1 : stop;
+            return true;
+        }
+    }
+    return false;
+}
+
+void nes_trace_start(nes_trace_t *trace, const char *ref, size_t ref_size) {
+    memset(trace, 0, sizeof(*trace));
+    trace->ref = ref;
+    trace->ref_size = ref ? ref_size : 0;
+    active = trace;
+}
+
+/* The PC of the first reference line, e.g. $C000 for nestest's automated
+ * mode. */
+bool nes_trace_entry_pc(const nes_trace_t *trace, uint16_t *pc) {
+    nes_trace_t probe = *trace;
+    const char *line;
+    const char *end;
+    trace_row_t row;
+    probe.ref_pos = 0;
+    if (!next_ref_line(&probe, &line, &end) || !parse_row(line, end, &row)) {
+        return false;
+    }
+    *pc = row.pc;
+    return true;
+}
+
+void nes_trace_format(const nes_t *nes, uint32_t cycles, char *line, size_t size) {
+    const nes_cpu_t *cpu = &nes->cpu;
+    snprintf(line, size, "%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lu",
+             (unsigned int)cpu->pc, (unsigned int)cpu->a, (unsigned int)cpu->x,
+             (unsigned int)cpu->y, (unsigned int)cpu->p, (unsigned int)cpu->sp,
+             (unsigned long)cycles);
+}
+
+void nes_trace_insn(const nes_t *nes) {
+    nes_trace_t *trace = active;
+    if (!trace) {
+        return;
+    }
+    const nes_cpu_t *cpu = &nes->cpu;
+    uint32_t cycles = nes->sched.now;
+    const char *line;
+    const char *end;
+    trace_row_t row;
+    bool have_ref = !trace->diverged && next_ref_line(trace, &line, &end) && parse_row(line, end, &row);
+    if (have_ref && !trace->started) {
+        trace->cycle_offset = row.cycles - cycles;
+    }
+    trace->started = true;
+    cycles += trace->cycle_offset;
+    if (trace->emit) {
+        char actual[NES_TRACE_LINE];
+        nes_trace_format(nes, cycles, actual, sizeof(actual));
+        trace->emit(trace->emit_ctx, actual);
+    }
+    if (!have_ref) {
+        return;
+    }
+    if (row.pc != cpu->pc || row.a != cpu->a || row.x != cpu->x || row.y != cpu->y ||
+        row.p != cpu->p || row.sp != cpu->sp || row.cycles != cycles) {
+        int len = (int)(end - line);
+        if (len >= NES_TRACE_LINE) {
+            len = NES_TRACE_LINE - 1;
+        }
+        memcpy(trace->expected, line, (size_t)len);
+        trace->expected[len] = '\0';
+        nes_trace_format(nes, cycles, trace->actual, sizeof(trace->actual));
+        trace->diverged = true;
+        return;
+    }
+    trace->compared++;
+}
+
+void nes_trace_unknown(uint16_t pc, uint8_t opcode) {
+    nes_trace_t *trace = active;
+    if (!trace) {
+        return;
+    }
+    if (trace->unknown[opcode]++ == 0) {
+        trace->unknown_pc[opcode] = pc;
+    }
+}
+
+void nes_trace_report(const nes_trace_t *trace, nes_report_fn emit, void *ctx) {
+    char line[NES_TRACE_LINE + 16];
+    snprintf(line, sizeof(line), "matched %lu", (unsigned long)trace->compared);
+    emit(ctx, line);
+    if (trace->diverged) {
+        snprintf(line, sizeof(line), "expected %s", trace->expected);
+        emit(ctx, line);
+        snprintf(line, sizeof(line), "actual   %s", trace->actual);
+        emit(ctx, line);
+    }
+    for (int op = 0; op < 256; op++) {
+        if (trace->unknown[op]) {
+            snprintf(line, sizeof(line), "unimplemented %02X x%lu first at %04X", (unsigned int)op,
+                     (unsigned long)trace->unknown[op], (unsigned int)trace->unknown_pc[op]);
+            emit(ctx, line);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef NES_TRACE_H
+#define NES_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nes.h"
+#include "nes_prof.h"
+
+#define NES_TRACE_LINE 96
+
+/* Compares each executed instruction against a nestest-style reference log
+ * ("C000 ... A:00 X:00 Y:00 P:24 SP:FD ... CYC:7"). Only the PC, registers
+ * and cycle count are checked; disassembly and PPU columns are ignored. */
+typedef struct {
+    const char *ref;
+    size_t ref_size;
+    size_t ref_pos;
+    uint32_t compared;
+    uint32_t cycle_offset;
+    bool started;
+    bool diverged;
+    char expected[NES_TRACE_LINE];
+    char actual[NES_TRACE_LINE];
+    uint32_t unknown[256];
+    uint16_t unknown_pc[256];
+    nes_report_fn emit;
+    void *emit_ctx;
+} nes_trace_t;
+
+#ifdef NES_TRACE
+void nes_trace_start(nes_trace_t *trace, const char *ref, size_t ref_size);
+bool nes_trace_entry_pc(const nes_trace_t *trace, uint16_t *pc);
+void nes_trace_format(const nes_t *nes, uint32_t cycles, char *line, size_t size);
+void nes_trace_insn(const nes_t *nes);
+void nes_trace_unknown(uint16_t pc, uint8_t opcode);
+void nes_trace_report(const nes_trace_t *trace, nes_report_fn emit, void *ctx);
+#define NES_TRACE_INSN(nes) nes_trace_insn(nes)
+#define NES_TRACE_UNKNOWN(pc, opcode) nes_trace_unknown((pc), (opcode))
+#else
+#define NES_TRACE_INSN(nes) ((void)0)
+#define NES_TRACE_UNKNOWN(pc, opcode) ((void)0)
+#endif
+
+#endif
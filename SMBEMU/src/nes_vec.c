@@ -0,0 +1,156 @@
+#include "nes_vec.h"
+
+#ifdef NES_VEC
+
+#include <string.h>
+#include "nes_cpu.h"
+#include "nes_mem.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+
+/* Everything up to the input binding, which is the only field that
+ * differs between otherwise identical lanes. */
+#define STATE_SIZE offsetof(nes_t, input_ctx)
+#define NO_LANE 0xFFFFu
+
+static uint8_t lane_input(void *ctx) {
+    return *(const uint8_t *)ctx;
+}
+
+static void bind(nes_vec_t *vec, uint16_t lane) {
+    nes_set_input_provider(&vec->instances[lane], lane_input, (void *)&vec->inputs[lane]);
+}
+
+/* FNV-1a over the state a word at a time. Only used to find candidates;
+ * lanes are compared in full before one is made to follow another. */
+static uint32_t hash_state(const nes_t *nes) {
+    const uint8_t *bytes = (const uint8_t *)nes;
+    uint32_t hash = 0x811C9DC5u;
+    size_t i = 0;
+    for (; i + 4 <= STATE_SIZE; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, 4);
+        hash = (hash ^ word) * 0x01000193u;
+    }
+    for (; i < STATE_SIZE; i++) {
+        hash = (hash ^ bytes[i]) * 0x01000193u;
+    }
+    return hash;
+}
+
+void nes_vec_init(nes_vec_t *vec, nes_t *instances, nes_vec_lane_t *lanes, const uint8_t *inputs,
+                  uint16_t count, nes_rom_t *rom) {
+    nes_rom_retain(rom);
+    vec->instances = instances;
+    vec->rom = rom;
+    vec->lanes = lanes;
+    vec->inputs = inputs;
+    vec->count = count;
+    vec->frames_run = 0;
+    vec->frames_shared = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        nes_t *nes = &instances[i];
+        nes_init(nes, rom);
+        nes_sched_reset(nes);
+        nes_ppu_reset(nes);
+        nes_cpu_reset(nes);
+        nes_apu_reset(nes);
+        bind(vec, i);
+    }
+}
+
+/* Drops the reference nes_vec_init took on the ROM. */
+void nes_vec_close(nes_vec_t *vec) {
+    nes_rom_release(vec->rom);
+    vec->rom = NULL;
+}
+
+/* Puts a lane in a saved state, e.g. the start of an episode. The lane
+ * stops following its old leader, and lanes that followed it stop doing so,
+ * so nes_vec_draw still gives each its own picture. */
+void nes_vec_set(nes_vec_t *vec, uint16_t lane, const nes_t *state) {
+    vec->instances[lane] = *state;
+    vec->instances[lane].audio = NULL;
+    bind(vec, lane);
+    vec->lanes[lane].leader = lane;
+    for (uint16_t i = 0; i < vec->count; i++) {
+        if (vec->lanes[i].leader == lane) {
+            vec->lanes[i].leader = i;
+        }
+    }
+}
+
+/* Groups lanes whose state and input match an earlier lane. The core keeps
+ * no state outside nes_t, so a group stays identical for the whole step.
+ * Leaders are chained into count buckets by hash, with lanes[b].head the
+ * first leader in bucket b, so a lane is only compared in full with
+ * leaders whose hash matches. */
+static void group(nes_vec_t *vec) {
+    nes_vec_lane_t *lanes = vec->lanes;
+    for (uint16_t i = 0; i < vec->count; i++) {
+        lanes[i].head = NO_LANE;
+    }
+    for (uint16_t i = 0; i < vec->count; i++) {
+        nes_vec_lane_t *lane = &lanes[i];
+        lane->hash = hash_state(&vec->instances[i]) ^ vec->inputs[i];
+        lane->leader = i;
+        uint16_t *bucket = &lanes[lane->hash % vec->count].head;
+        for (uint16_t j = *bucket; j != NO_LANE; j = lanes[j].next) {
+            if (lanes[j].hash == lane->hash && vec->inputs[j] == vec->inputs[i] &&
+                memcmp(&vec->instances[j], &vec->instances[i], STATE_SIZE) == 0) {
+                lane->leader = j;
+                break;
+            }
+        }
+        if (lane->leader == i) {
+            lane->next = *bucket;
+            *bucket = i;
+        }
+    }
+}
+
+/* Runs every lane for frames frames with its current input held. Each
+ * leader runs to completion before the next starts, which keeps one
+ * instance's state in cache at a time. */
+void nes_vec_step(nes_vec_t *vec, uint16_t frames) {
+    group(vec);
+    for (uint16_t i = 0; i < vec->count; i++) {
+        uint16_t leader = vec->lanes[i].leader;
+        if (leader == i) {
+            for (uint16_t frame = 0; frame < frames; frame++) {
+                nes_cpu_run(&vec->instances[i], NES_FRAME_CYCLES);
+            }
+            vec->frames_run += frames;
+        } else {
+            vec->instances[i] = vec->instances[leader];
+            bind(vec, i);
+            vec->frames_shared += frames;
+        }
+    }
+}
+
+nes_vec_view_t nes_vec_ram(const nes_vec_t *vec) {
+    nes_vec_view_t view = { vec->instances[0].ram, sizeof(nes_t), NES_RAM_SIZE };
+    return view;
+}
+
+/* Renders every lane into frames, NES_VEC_FRAME_SIZE bytes each. Lanes
+ * that followed another this step are copied rather than drawn again. */
+void nes_vec_draw(const nes_vec_t *vec, uint8_t *frames) {
+    static nes_ppu_frame_t frame;
+    for (uint16_t i = 0; i < vec->count; i++) {
+        uint8_t *out = frames + (size_t)i * NES_VEC_FRAME_SIZE;
+        uint16_t leader = vec->lanes[i].leader;
+        if (leader != i) {
+            memcpy(out, frames + (size_t)leader * NES_VEC_FRAME_SIZE, NES_VEC_FRAME_SIZE);
+            continue;
+        }
+        memset(out, 0, NES_VEC_FRAME_SIZE);
+        nes_ppu_capture(&vec->instances[i], &frame);
+        nes_ppu_draw(&frame, vec->instances[i].chr, out);
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef NES_VEC_H
+#define NES_VEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "nes.h"
+
+/* Steps many instances of one ROM together, for batch and training runs
+ * on a host. Built only with -DNES_VEC; the calculator has no room for
+ * more than one instance.
+ *
+ * All storage belongs to the caller: instances is the nes_t array, inputs
+ * holds one controller byte per instance and is read in place each step,
+ * and lanes is bookkeeping. count must be below 65535. Instances that are identical and are given the
+ * same input run once per step and the others take a copy of the result,
+ * so lanes that were reset to the same state cost one emulation until
+ * their inputs differ. Lanes that have diverged cost what separate
+ * instances would, plus hashing each state once per step; tools/vec.c
+ * measures both against plain nes_cpu_run loops. */
+typedef struct {
+    uint32_t hash;
+    uint16_t leader;
+    uint16_t head;
+    uint16_t next;
+} nes_vec_lane_t;
+
+typedef struct {
+    nes_t *instances;
+    nes_rom_t *rom;
+    nes_vec_lane_t *lanes;
+    const uint8_t *inputs;
+    uint16_t count;
+    uint32_t frames_run;
+    uint32_t frames_shared;
+} nes_vec_t;
+
+/* A strided view of the same field in every instance: element i is at
+ * base + i * stride, with no copying. */
+typedef struct {
+    const uint8_t *base;
+    size_t stride;
+    size_t size;
+} nes_vec_view_t;
+
+/* Observation frames are NES_VEC_FRAME_SIZE bytes per instance, laid out
+ * like the calculator screen: 320 palette indices per row, the picture in
+ * columns 32-287. */
+#define NES_VEC_FRAME_SIZE (320 * NES_SCREEN_HEIGHT)
+
+#ifdef NES_VEC
+void nes_vec_init(nes_vec_t *vec, nes_t *instances, nes_vec_lane_t *lanes, const uint8_t *inputs,
+                  uint16_t count, nes_rom_t *rom);
+void nes_vec_close(nes_vec_t *vec);
+void nes_vec_set(nes_vec_t *vec, uint16_t lane, const nes_t *state);
+void nes_vec_step(nes_vec_t *vec, uint16_t frames);
+nes_vec_view_t nes_vec_ram(const nes_vec_t *vec);
+void nes_vec_draw(const nes_vec_t *vec, uint8_t *frames);
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+#include "pace.h"
+#include <sys/timers.h>
+#include <fileioc.h>
+#include <string.h>
+
+/* NTSC runs at 1789773 / 29780.5 = 60.0988 Hz, which is 545.2353 ticks of the
+ * 32768 Hz timer. The fraction is accumulated in 1/65536 tick units. */
+#define PACE_TIMER 1
+#define PACE_TICKS_PER_FRAME 545u
+#define PACE_TICK_FRAC 15421u
+#define PACE_MAX_LAG (PACE_TICKS_PER_FRAME * 4u)
+
+static uint32_t ticks(void) {
+    return timer_Get(PACE_TIMER);
+}
+
+static uint16_t clamp16(uint32_t value) {
+    return value > 0xFFFFu ? 0xFFFFu : (uint16_t)value;
+}
+
+void pace_init(pace_t *pace) {
+    memset(pace, 0, sizeof(*pace));
+    timer_Disable(PACE_TIMER);
+    timer_Set(PACE_TIMER, 0);
+    timer_Enable(PACE_TIMER, TIMER_32K, TIMER_NOINT, TIMER_UP);
+    pace->mark = ticks();
+    pace->deadline = pace->mark + PACE_TICKS_PER_FRAME;
+}
+
+void pace_end_cpu(pace_t *pace) {
+    uint32_t now = ticks();
+    pace->current.cpu = clamp16(now - pace->mark);
+    pace->current.render = 0;
+    pace->mark = now;
+}
+
+/* Skips drawing while the frame is already late, but never more than
+ * PACE_MAX_SKIP frames in a row so the screen keeps updating. */
+bool pace_should_render(pace_t *pace) {
+    bool late = (int32_t)(ticks() - pace->deadline) > 0;
+    if (late && pace->skip_run < PACE_MAX_SKIP) {
+        pace->skip_run++;
+        pace->skipped++;
+        return false;
+    }
+    pace->skip_run = 0;
+    return true;
+}
+
+void pace_end_render(pace_t *pace) {
+    uint32_t now = ticks();
+    pace->current.render = clamp16(now - pace->mark);
+    pace->mark = now;
+}
+
+/* Snapshot saves and restores are timed inside the CPU and render phases
+ * and add up per frame; they are still counted in those phases too. */
+void pace_begin_snapshot(pace_t *pace) {
+    pace->snapshot_start = ticks();
+}
+
+void pace_end_snapshot(pace_t *pace) {
+    pace->current.snapshot = clamp16(pace->current.snapshot + (ticks() - pace->snapshot_start));
+}
+
+void pace_wait(pace_t *pace) {
+    uint32_t now = ticks();
+    int32_t ahead = (int32_t)(pace->deadline - now);
+    if (ahead > 0) {
+        while ((int32_t)(pace->deadline - ticks()) > 0) {
+        }
+        pace->current.slack = clamp16((uint32_t)ahead);
+    } else {
+        pace->current.slack = 0;
+        if ((uint32_t)-ahead > PACE_MAX_LAG) {
+            pace->deadline = now;
+        }
+    }
+    uint32_t frac = (uint32_t)pace->frac + PACE_TICK_FRAC;
+    pace->deadline += PACE_TICKS_PER_FRAME + (frac >> 16);
+    pace->frac = (uint16_t)frac;
+    pace->mark = ticks();
+
+    pace->log[pace->head] = pace->current;
+    pace->head = (uint8_t)((pace->head + 1) % PACE_LOG_SIZE);
+    if (pace->count < PACE_LOG_SIZE) {
+        pace->count++;
+    }
+    pace->current.snapshot = 0;
+    pace->frames++;
+}
+
+/* Writes the logged samples oldest first, preceded by the frame and skip
+ * totals. */
+bool pace_dump(const pace_t *pace, const char *appvar_name) {
+    ti_var_t handle = ti_Open(appvar_name, "w");
+    if (!handle) {
+        return false;
+    }
+    bool ok = ti_Write(&pace->frames, sizeof(pace->frames), 1, handle) == 1 &&
+              ti_Write(&pace->skipped, sizeof(pace->skipped), 1, handle) == 1;
+    uint8_t index = (uint8_t)((pace->head + PACE_LOG_SIZE - pace->count) % PACE_LOG_SIZE);
+    for (uint8_t i = 0; ok && i < pace->count; i++) {
+        ok = ti_Write(&pace->log[index], sizeof(pace_sample_t), 1, handle) == 1;
+        index = (uint8_t)((index + 1) % PACE_LOG_SIZE);
+    }
+    ti_Close(handle);
+    return ok;
+}
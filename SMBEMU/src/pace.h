@@ -0,0 +1,41 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PACE_LOG_SIZE 128
+#define PACE_MAX_SKIP 4
+
+/* Per-frame timings in 32768 Hz timer ticks. */
+typedef struct {
+    uint16_t cpu;
+    uint16_t render;
+    uint16_t slack;
+    uint16_t snapshot;
+} pace_sample_t;
+
+typedef struct {
+    uint32_t deadline;
+    uint16_t frac;
+    uint32_t mark;
+    pace_sample_t current;
+    pace_sample_t log[PACE_LOG_SIZE];
+    uint8_t head;
+    uint8_t count;
+    uint8_t skip_run;
+    uint32_t snapshot_start;
+    uint32_t frames;
+    uint32_t skipped;
+} pace_t;
+
+void pace_init(pace_t *pace);
+void pace_end_cpu(pace_t *pace);
+bool pace_should_render(pace_t *pace);
+void pace_end_render(pace_t *pace);
+void pace_begin_snapshot(pace_t *pace);
+void pace_end_snapshot(pace_t *pace);
+void pace_wait(pace_t *pace);
+bool pace_dump(const pace_t *pace, const char *appvar_name);
+
+#endif
@@ -4,6 +4,6 @@
 #include <stdbool.h>
 #include "nes.h"
 
-bool rom_load_smb(nes_t *nes, const char **error);
+bool rom_load_smb(nes_rom_t *rom, const char **error);
 
 #endif
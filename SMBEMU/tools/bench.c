@@ -0,0 +1,168 @@
+/* Runs the BENCH=YES microbenchmarks on a PC, for comparing two builds of
+ * the core without a calculator. Runs on a PC:
+ *
+ *   cc -std=c99 -O2 -DNES_BENCH -Ihost -I../src -o bench bench.c host/rom_map.c \
+ *      ../src/bench.c ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c \
+ *      ../src/nes_sched.c ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c
+ *   ./bench smb.nes [-o results.json] [-b baseline.json]
+ *
+ *   -o FILE        also write the JSON report here (SMBBENCH format)
+ *   -b FILE        compare against an earlier report, as SMBBASE does
+ *
+ * The JSON report goes to stdout. With -b, the comparison follows it, one
+ * "name baseline_ns current_ns change_pct" line per case. The rom.load case
+ * maps and parses the ROM file again, where the calculator reloads SMBROM.
+ * Host timings are only comparable with other host runs: clock() counts
+ * whole microseconds, so the fastest cases resolve to a few ticks. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "bench.h"
+#include "rom.h"
+#include "rom_map.h"
+
+#ifndef NES_BENCH
+#error "build with -DNES_BENCH"
+#endif
+
+typedef struct {
+    char *text;
+    size_t size;
+    size_t capacity;
+    FILE *copy;
+} report_t;
+
+static const char *rom_path;
+
+/* bench.c's rom.load case; the ROM it returns is dropped by the caller. */
+bool rom_load_smb(nes_rom_t *rom, const char **error) {
+    nes_rom_t *mapped = rom_map(rom_path, error);
+    (void)rom;
+    if (!mapped) {
+        return false;
+    }
+    nes_rom_release(mapped);
+    return true;
+}
+
+static void collect_line(void *ctx, const char *line) {
+    report_t *report = ctx;
+    size_t length = strlen(line);
+    if (report->size + length + 1 > report->capacity) {
+        size_t capacity = (report->capacity + length + 1) * 2;
+        char *text = realloc(report->text, capacity);
+        if (!text) {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+        report->text = text;
+        report->capacity = capacity;
+    }
+    memcpy(report->text + report->size, line, length);
+    report->text[report->size + length] = '\n';
+    report->size += length + 1;
+    puts(line);
+    if (report->copy) {
+        fprintf(report->copy, "%s\n", line);
+    }
+}
+
+static void print_line(void *ctx, const char *line) {
+    (void)ctx;
+    puts(line);
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    long length = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char *data = malloc(length > 0 ? (size_t)length : 1);
+    if (!data || (length > 0 && fread(data, 1, (size_t)length, in) != (size_t)length)) {
+        free(data);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+    *size = length > 0 ? (size_t)length : 0;
+    return data;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.nes [-o results.json] [-b baseline.json]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static nes_t nes;
+    report_t report = { NULL, 0, 0, NULL };
+    const char *out_path = NULL;
+    const char *base_path = NULL;
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            base_path = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    rom_path = argv[1];
+    const char *error;
+    nes_rom_t *rom = rom_map(rom_path, &error);
+    if (!rom) {
+        fprintf(stderr, "%s: %s\n", rom_path, error);
+        return 2;
+    }
+    size_t base_size = 0;
+    char *base = NULL;
+    if (base_path) {
+        base = read_file(base_path, &base_size);
+        if (!base) {
+            fprintf(stderr, "cannot read %s\n", base_path);
+            return 2;
+        }
+    }
+    if (out_path) {
+        report.copy = fopen(out_path, "w");
+        if (!report.copy) {
+            fprintf(stderr, "cannot write %s\n", out_path);
+            return 2;
+        }
+    }
+
+    nes_init(&nes, rom);
+    nes_sched_reset(&nes);
+    nes_ppu_reset(&nes);
+    nes_cpu_reset(&nes);
+    nes_apu_reset(&nes);
+    bench_run(&nes, collect_line, &report);
+    if (report.copy) {
+        fclose(report.copy);
+    }
+    if (base) {
+        bench_compare(base, base_size, report.text, report.size, print_line, NULL);
+    }
+
+    free(base);
+    free(report.text);
+    nes_rom_release(rom);
+    return 0;
+}
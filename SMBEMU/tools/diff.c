@@ -0,0 +1,141 @@
+/* Differential check of nes_cpu_run against nes_cpu_step, one instruction
+ * at a time from randomised states. Runs on a PC. The build that matters
+ * links the recompiled blocks, so nes_cpu_run goes through them while the
+ * reference steps the interpreter; APU=YES state is compared too:
+ *
+ *   ./recomp smb.nes ../src/nes_recomp_gen.c
+ *   cc -std=c99 -O2 -DNES_DIFF -DNES_RECOMP -DNES_APU -Ihost -I../src -o diff diff.c \
+ *      host/rom_map.c ../src/nes_diff.c ../src/nes_recomp.c ../src/nes_recomp_gen.c \
+ *      ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c ../src/nes_sched.c \
+ *      ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c
+ *
+ * Without -DNES_RECOMP both sides run the same interpreter and only the
+ * slicing in nes_cpu_run is under test, which catches little.
+ *
+ *   ./diff smb.nes [options]
+ *
+ *   -r N           rounds, each from a fresh random state (default 20)
+ *   -n N           instructions per round (default 20000)
+ *   -b N           frames to boot before the first round (default 60)
+ *   -s N           random seed (default 1)
+ *   -c             self-check: the tested side drops the carry flag after
+ *                  any step taken while RAM $0000 is odd, which should be
+ *                  caught and minimised down to that byte and whatever
+ *                  the failing path reads, unless the ROM rewrites $0000
+ *                  or never sets carry
+ *
+ * Each round copies the booted instance, randomises its registers, RAM and
+ * PPU memory (nes_diff_randomize) and steps both sides with the same random
+ * controller input. The first divergence is reported with the field that
+ * differs, and its starting state is minimised by clearing RAM until the
+ * failure would go away. The exit status is 1 on a divergence. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "nes_diff.h"
+#include "rom_map.h"
+
+#ifndef NES_DIFF
+#error "build with -DNES_DIFF"
+#endif
+
+#ifdef NES_RECOMP
+#define TESTED "recompiled blocks"
+#else
+#define TESTED "interpreter only"
+#endif
+
+static void print_line(void *ctx, const char *line) {
+    (void)ctx;
+    puts(line);
+}
+
+static int broken_step(nes_t *nes) {
+    bool odd = nes->ram[0] & 1;
+    int cycles = nes_diff_run_step(nes);
+    if (odd) {
+        nes->cpu.p &= (uint8_t)~FLAG_C;
+    }
+    return cycles;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.nes [-r rounds] [-n steps] [-b frames] [-s seed] [-c]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static nes_t boot;
+    static nes_t initial;
+    static nes_t ref;
+    static nes_t test;
+    uint32_t rounds = 20;
+    uint32_t steps = 20000;
+    uint32_t boot_frames = 60;
+    uint32_t seed = 1;
+    nes_step_fn test_step = nes_diff_run_step;
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            test_step = broken_step;
+        } else if (i + 1 < argc && argv[i][0] == '-' && argv[i][1] && strchr("rnbs", argv[i][1]) &&
+                   !argv[i][2]) {
+            uint32_t value = (uint32_t)strtoul(argv[++i], NULL, 0);
+            switch (argv[i - 1][1]) {
+            case 'r': rounds = value; break;
+            case 'n': steps = value; break;
+            case 'b': boot_frames = value; break;
+            default: seed = value ? value : 1; break;
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    const char *error;
+    nes_rom_t *rom = rom_map(argv[1], &error);
+    if (!rom) {
+        fprintf(stderr, "%s: %s\n", argv[1], error);
+        return 2;
+    }
+    nes_init(&boot, rom);
+    nes_sched_reset(&boot);
+    nes_ppu_reset(&boot);
+    nes_cpu_reset(&boot);
+    nes_apu_reset(&boot);
+    for (uint32_t frame = 0; frame < boot_frames; frame++) {
+        nes_cpu_run(&boot, NES_FRAME_CYCLES);
+    }
+
+    nes_diff_t diff;
+    bool diverged = nes_diff_fuzz(&boot, &initial, &ref, &test, nes_diff_reference_step, test_step,
+                                  rounds, steps, seed, &diff);
+    if (diverged) {
+        uint16_t live = 0;
+        for (uint16_t i = 0; i < NES_RAM_SIZE; i++) {
+            live += initial.ram[i] != 0;
+        }
+        nes_diff_report(&diff, print_line, NULL);
+        printf("from pc %04X a %02X x %02X y %02X p %02X sp %02X, %u live RAM bytes\n",
+               (unsigned int)initial.cpu.pc, (unsigned int)initial.cpu.a, (unsigned int)initial.cpu.x,
+               (unsigned int)initial.cpu.y, (unsigned int)initial.cpu.p, (unsigned int)initial.cpu.sp,
+               (unsigned int)live);
+    } else {
+        printf("%lu rounds of %lu steps, no divergence (" TESTED ")\n", (unsigned long)rounds,
+               (unsigned long)steps);
+    }
+    nes_rom_release(rom);
+    return diverged ? 1 : 0;
+}
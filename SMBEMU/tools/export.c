@@ -0,0 +1,207 @@
+/* Converts raw palette-index frames to video. Runs on a PC:
+ *
+ *   cc -std=c11 -O2 -pthread -I../src -o export export.c ../src/nes_palette.c
+ *   ./export [options] [input [output]]
+ *
+ *   -f y4m         YUV4MPEG2, 4:4:4 at the NTSC frame rate (default)
+ *   -f rgb         raw 24-bit RGB, 256x240, one frame after another
+ *
+ * Input is 256x240 bytes per frame, one palette index per pixel, which is
+ * the layout of SMBFRAME's data and of tools/replay.c -f; input and output
+ * default to stdin and stdout, and "-" names them explicitly, so a replay
+ * can be piped straight in for long soak runs:
+ *
+ *   ./replay smb.nes movie -f - | ./export - run.y4m
+ *
+ * Reading and writing are split across two threads. The reader only
+ * compares each frame with the last one and queues it, marking identical
+ * ones as repeats. The writer converts through per-index lookup tables and
+ * writes, and for a repeat writes its previous output again without
+ * converting anything. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include "nes_atomic.h"
+#include "nes_palette.h"
+
+#define WIDTH 256
+#define HEIGHT 240
+#define PIXELS (WIDTH * HEIGHT)
+#define QUEUE_SLOTS 8
+
+typedef enum {
+    FORMAT_Y4M,
+    FORMAT_RGB
+} format_t;
+
+typedef struct {
+    bool repeat;
+    uint8_t pixels[PIXELS];
+} slot_t;
+
+/* Frames from the reader to the writer; the same single-producer,
+ * single-consumer counters as the emulator's frame pipe. */
+static slot_t slots[QUEUE_SLOTS];
+static nes_atomic_t queued;
+static nes_atomic_t written;
+static nes_atomic_t finished;
+
+static format_t format = FORMAT_Y4M;
+static FILE *out;
+static uint8_t lut_rgb[64][3];
+static uint8_t lut_yuv[64][3];
+static uint8_t output[PIXELS * 3];
+static size_t output_size;
+static unsigned long frames;
+static unsigned long repeats;
+
+static uint8_t clamp8(double value) {
+    return value < 0 ? 0 : value > 255 ? 255 : (uint8_t)(value + 0.5);
+}
+
+/* Studio-range BT.601, what Y4M players assume without a colour tag. */
+static void build_luts(void) {
+    for (int i = 0; i < 64; i++) {
+        double r = (nes_palette_rgb[i] >> 16) & 0xFF;
+        double g = (nes_palette_rgb[i] >> 8) & 0xFF;
+        double b = nes_palette_rgb[i] & 0xFF;
+        lut_rgb[i][0] = (uint8_t)r;
+        lut_rgb[i][1] = (uint8_t)g;
+        lut_rgb[i][2] = (uint8_t)b;
+        lut_yuv[i][0] = clamp8(16 + (65.481 * r + 128.553 * g + 24.966 * b) / 255);
+        lut_yuv[i][1] = clamp8(128 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255);
+        lut_yuv[i][2] = clamp8(128 + (112.0 * r - 93.786 * g - 18.214 * b) / 255);
+    }
+}
+
+static void convert(const uint8_t *pixels) {
+    if (format == FORMAT_Y4M) {
+        uint8_t *y = output;
+        uint8_t *u = output + PIXELS;
+        uint8_t *v = output + PIXELS * 2;
+        for (size_t i = 0; i < PIXELS; i++) {
+            const uint8_t *yuv = lut_yuv[pixels[i] & 0x3F];
+            y[i] = yuv[0];
+            u[i] = yuv[1];
+            v[i] = yuv[2];
+        }
+    } else {
+        uint8_t *rgb = output;
+        for (size_t i = 0; i < PIXELS; i++) {
+            memcpy(rgb, lut_rgb[pixels[i] & 0x3F], 3);
+            rgb += 3;
+        }
+    }
+    output_size = PIXELS * 3;
+}
+
+static bool emit(void) {
+    if (format == FORMAT_Y4M && fputs("FRAME\n", out) == EOF) {
+        return false;
+    }
+    return fwrite(output, 1, output_size, out) == output_size;
+}
+
+static void *writer(void *arg) {
+    (void)arg;
+    for (;;) {
+        unsigned int index = nes_atomic_load(&written);
+        bool done = nes_atomic_load(&finished);
+        if (nes_atomic_load(&queued) == index) {
+            if (done) {
+                return NULL;
+            }
+            sched_yield();
+            continue;
+        }
+        slot_t *slot = &slots[index % QUEUE_SLOTS];
+        if (!slot->repeat) {
+            convert(slot->pixels);
+        }
+        if (!emit()) {
+            fprintf(stderr, "export: write failed\n");
+            exit(1);
+        }
+        nes_atomic_store(&written, index + 1);
+    }
+}
+
+/* Waits for a free slot; a converter has no reason to drop frames. */
+static slot_t *next_slot(void) {
+    unsigned int index = nes_atomic_load(&queued);
+    while (index - nes_atomic_load(&written) >= QUEUE_SLOTS) {
+        sched_yield();
+    }
+    return &slots[index % QUEUE_SLOTS];
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: export [-f y4m|rgb] [input [output]]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *paths[2] = { "-", "-" };
+    int path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "y4m")) {
+                format = FORMAT_Y4M;
+            } else if (!strcmp(argv[i], "rgb")) {
+                format = FORMAT_RGB;
+            } else {
+                usage();
+            }
+        } else if (path_count < 2 && (argv[i][0] != '-' || !argv[i][1])) {
+            paths[path_count++] = argv[i];
+        } else {
+            usage();
+        }
+    }
+    FILE *in = strcmp(paths[0], "-") ? fopen(paths[0], "rb") : stdin;
+    out = strcmp(paths[1], "-") ? fopen(paths[1], "wb") : stdout;
+    if (!in || !out) {
+        fprintf(stderr, "export: cannot open %s\n", !in ? paths[0] : paths[1]);
+        return 1;
+    }
+    build_luts();
+    if (format == FORMAT_Y4M) {
+        /* 1789773 / 29780.5 frames per second, as in pace.c. */
+        fprintf(out, "YUV4MPEG2 W%d H%d F3579546:59561 Ip A8:7 C444\n", WIDTH, HEIGHT);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer, NULL)) {
+        fprintf(stderr, "export: cannot start writer thread\n");
+        return 1;
+    }
+    for (;;) {
+        slot_t *slot = next_slot();
+        if (fread(slot->pixels, 1, PIXELS, in) != PIXELS) {
+            break;
+        }
+        /* The previous slot stays untouched until QUEUE_SLOTS more frames
+         * have been read, so it can be compared against in place. */
+        const slot_t *previous = &slots[(frames + QUEUE_SLOTS - 1) % QUEUE_SLOTS];
+        slot->repeat = frames && !memcmp(slot->pixels, previous->pixels, PIXELS);
+        repeats += slot->repeat;
+        frames++;
+        nes_atomic_store(&queued, nes_atomic_load(&queued) + 1);
+    }
+    nes_atomic_store(&finished, 1);
+    pthread_join(thread, NULL);
+    fprintf(stderr, "export: %lu frames, %lu repeats\n", frames, repeats);
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+/* Stand-in for the CE toolchain's graphx.h, so PC tools can link the core.
+ * It covers only what nes_ppu.c uses: the palette upload and the full-frame
+ * render both do nothing, since PC tools read pixels from nes_ppu_capture
+ * and nes_ppu_draw themselves. */
+
+#ifndef HOST_GRAPHX_H
+#define HOST_GRAPHX_H
+
+#include <stdint.h>
+
+static uint8_t host_vbuffer[240][320];
+
+#define gfx_vbuffer ((uint8_t *)host_vbuffer)
+#define gfx_RGBTo1555(r, g, b) ((uint16_t)(((r) >> 3) << 10 | ((g) >> 3) << 5 | ((b) >> 3)))
+#define gfx_SetPalette(palette, size, offset) ((void)(palette), (void)(size), (void)(offset))
+#define gfx_FillScreen(color) ((void)(color))
+
+#endif
@@ -0,0 +1,65 @@
+/* Loads an iNES file for PC tools. A 32 KB PRG image is mapped read-only
+ * and used in place, so every instance, thread and process running the
+ * same file shares the page cache's copy; a 16 KB or compressed one is
+ * copied once to mirror or decode it. The returned ROM holds one reference
+ * and unmaps itself on the last nes_rom_release. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rom_map.h"
+#include "nes_rom.h"
+
+typedef struct {
+    nes_rom_t rom;
+    void *image;
+    size_t size;
+    nes_rom_banks_t *banks;
+} mapped_rom_t;
+
+static void unmap(nes_rom_t *rom) {
+    mapped_rom_t *mapped = (mapped_rom_t *)rom;
+    munmap(mapped->image, mapped->size);
+    free(mapped->banks);
+    free(mapped);
+}
+
+nes_rom_t *rom_map(const char *path, const char **error) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        *error = "cannot read ROM file";
+        return NULL;
+    }
+    void *image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    mapped_rom_t *mapped = calloc(1, sizeof(*mapped));
+    if (image == MAP_FAILED || !mapped) {
+        if (image != MAP_FAILED) {
+            munmap(image, (size_t)st.st_size);
+        }
+        free(mapped);
+        *error = "cannot map ROM file";
+        return NULL;
+    }
+    mapped->image = image;
+    mapped->size = (size_t)st.st_size;
+    const uint8_t *bytes = image;
+    bool packed = mapped->size >= NES_ROM_PACKED_MAGIC_SIZE &&
+                  memcmp(bytes, NES_ROM_PACKED_MAGIC, NES_ROM_PACKED_MAGIC_SIZE) == 0;
+    if (packed || (mapped->size > 4 && bytes[4] == 1)) {
+        mapped->banks = malloc(sizeof(nes_rom_banks_t));
+    }
+    if (!nes_rom_parse(&mapped->rom, bytes, mapped->size, mapped->banks, error)) {
+        unmap(&mapped->rom);
+        return NULL;
+    }
+    mapped->rom.release = unmap;
+    return &mapped->rom;
+}
@@ -0,0 +1,8 @@
+#ifndef HOST_ROM_MAP_H
+#define HOST_ROM_MAP_H
+
+#include "nes.h"
+
+nes_rom_t *rom_map(const char *path, const char **error);
+
+#endif
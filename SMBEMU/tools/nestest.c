@@ -0,0 +1,115 @@
+/* Runs a CPU test ROM against a nestest-style log with the TRACE=YES
+ * comparator, without the 64 KB AppVar limit on the log. Runs on a PC:
+ *
+ *   cc -std=c99 -O2 -DNES_TRACE -Ihost -I../src -o nestest nestest.c host/rom_map.c \
+ *      ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c ../src/nes_sched.c \
+ *      ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c ../src/nes_trace.c
+ *   ./nestest nestest.nes nestest.log [frames]
+ *
+ * Execution starts at the first PC in the log, $C000 for nestest's
+ * automated mode, and stops at the first divergence, at the end of the log
+ * or after frames frames (default 600). The report is the one SMBTRC gets,
+ * plus nestest's own result bytes at $02 and $03, which are zero when every
+ * test passed. The exit status is 0 only when the whole log matched and no
+ * unimplemented opcode was hit, so the runner can gate a change.
+ *
+ * blargg's ROMs report through PRG RAM at $6000, which the NROM core does
+ * not map, so only logs of the nestest kind can be checked. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "nes_trace.h"
+#include "rom_map.h"
+
+#ifndef NES_TRACE
+#error "build with -DNES_TRACE"
+#endif
+
+static void print_line(void *ctx, const char *line) {
+    (void)ctx;
+    puts(line);
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    long length = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char *data = length > 0 ? malloc((size_t)length) : NULL;
+    if (!data || fread(data, 1, (size_t)length, in) != (size_t)length) {
+        free(data);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+    *size = (size_t)length;
+    return data;
+}
+
+int main(int argc, char **argv) {
+    static nes_t nes;
+    static nes_trace_t trace;
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "usage: %s rom.nes reference.log [frames]\n", argv[0]);
+        return 2;
+    }
+    long frames = argc == 4 ? strtol(argv[3], NULL, 10) : 600;
+    const char *error;
+    nes_rom_t *rom = rom_map(argv[1], &error);
+    if (!rom) {
+        fprintf(stderr, "%s: %s\n", argv[1], error);
+        return 2;
+    }
+    size_t ref_size;
+    char *ref = read_file(argv[2], &ref_size);
+    if (!ref) {
+        fprintf(stderr, "cannot read %s\n", argv[2]);
+        return 2;
+    }
+
+    nes_init(&nes, rom);
+    nes_sched_reset(&nes);
+    nes_ppu_reset(&nes);
+    nes_cpu_reset(&nes);
+    nes_apu_reset(&nes);
+    nes_trace_start(&trace, ref, ref_size);
+    uint16_t pc;
+    if (!nes_trace_entry_pc(&trace, &pc)) {
+        fprintf(stderr, "%s: no PC on the first line\n", argv[2]);
+        return 2;
+    }
+    nes.cpu.pc = pc;
+
+    long frame = 0;
+    while (frame < frames && !trace.diverged && trace.ref_pos < trace.ref_size) {
+        nes_cpu_run(&nes, NES_FRAME_CYCLES);
+        frame++;
+    }
+
+    nes_trace_report(&trace, print_line, NULL);
+    printf("result %02X %02X\n", (unsigned int)nes.ram[0x02], (unsigned int)nes.ram[0x03]);
+    bool complete = trace.ref_pos >= trace.ref_size;
+    if (!complete && !trace.diverged) {
+        printf("log not finished after %ld frames\n", frame);
+    }
+    bool unknown = false;
+    for (int op = 0; op < 256; op++) {
+        unknown = unknown || trace.unknown[op] != 0;
+    }
+    free(ref);
+    nes_rom_release(rom);
+    return complete && !trace.diverged && !unknown ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/* Runs a ROM with emulation and drawing on separate threads, the split the
+ * frame pipe in nes_ppu.h was built for. Runs on a PC:
+ *
+ *   cc -std=c11 -O2 -pthread -Ihost -I../src -o play play.c host/rom_map.c \
+ *      ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c ../src/nes_sched.c \
+ *      ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c
+ *   ./play smb.nes [options]
+ *
+ *   -m FILE        controller input, one byte per frame (SMBMOVIE format);
+ *                  no buttons once it runs out
+ *   -n N           frames to run (default 3600)
+ *   -w             wait for the renderer when both pipe slots are full
+ *                  instead of dropping the frame, so every frame is drawn
+ *
+ * The emulation thread runs a frame, captures it into the pipe's back slot
+ * and publishes it, or drops it when the renderer still holds both slots,
+ * as the calculator does. The render thread draws each published frame
+ * into its own buffer and releases it. The same frames are then run again
+ * with capture and draw inline on one thread, and both wall times are
+ * reported. It needs C11: the pipe's C99 counters are only safe on one
+ * core. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "nes_atomic.h"
+#include "rom_map.h"
+
+#if !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L || defined(__STDC_NO_ATOMICS__)
+#error "build as C11 with atomics; the frame pipe's C99 fallback is single-core only"
+#endif
+
+#if defined(NES_PROFILE) || defined(NES_DEBUG) || defined(NES_PERF)
+#error "PROFILE, DEBUG and PERF keep global state that the render thread would share"
+#endif
+
+#define SCREEN_BYTES (320 * NES_SCREEN_HEIGHT)
+
+static nes_rom_t *rom;
+static const uint8_t *movie;
+static size_t movie_size;
+static uint32_t frame_count = 3600;
+static bool wait_for_renderer;
+
+static nes_ppu_pipe_t frame_pipe;
+static nes_atomic_t finished;
+static uint32_t frames_drawn;
+static uint32_t frames_dropped;
+static uint8_t screen[SCREEN_BYTES];
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void start(nes_t *nes) {
+    nes_init(nes, rom);
+    nes_sched_reset(nes);
+    nes_ppu_reset(nes);
+    nes_cpu_reset(nes);
+    nes_apu_reset(nes);
+}
+
+static void run_frame(nes_t *nes, uint32_t frame) {
+    nes_set_controller(nes, frame < movie_size ? movie[frame] : 0);
+    nes_cpu_run(nes, NES_FRAME_CYCLES);
+}
+
+static void *render_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        const nes_ppu_frame_t *frame = nes_ppu_pipe_front(&frame_pipe);
+        if (!frame) {
+            if (nes_atomic_load(&finished)) {
+                /* Anything published before finished was set is visible
+                 * now; check once more before leaving. */
+                if (!nes_ppu_pipe_front(&frame_pipe)) {
+                    break;
+                }
+                continue;
+            }
+            sched_yield();
+            continue;
+        }
+        nes_ppu_draw(frame, rom->chr, screen);
+        nes_ppu_pipe_release(&frame_pipe);
+        frames_drawn++;
+    }
+    return NULL;
+}
+
+static void run_threaded(void) {
+    static nes_t nes;
+    pthread_t renderer;
+    start(&nes);
+    nes_ppu_pipe_init(&frame_pipe);
+    nes_atomic_store(&finished, 0);
+    if (pthread_create(&renderer, NULL, render_main, NULL) != 0) {
+        fprintf(stderr, "cannot start the render thread\n");
+        exit(2);
+    }
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+        run_frame(&nes, frame);
+        nes_ppu_frame_t *back = nes_ppu_pipe_back(&frame_pipe);
+        while (!back && wait_for_renderer) {
+            sched_yield();
+            back = nes_ppu_pipe_back(&frame_pipe);
+        }
+        if (!back) {
+            frames_dropped++;
+            continue;
+        }
+        nes_ppu_capture(&nes, back);
+        nes_ppu_pipe_publish(&frame_pipe);
+    }
+    nes_atomic_store(&finished, 1);
+    pthread_join(renderer, NULL);
+}
+
+static void run_inline(void) {
+    static nes_t nes;
+    static nes_ppu_frame_t frame;
+    start(&nes);
+    for (uint32_t i = 0; i < frame_count; i++) {
+        run_frame(&nes, i);
+        nes_ppu_capture(&nes, &frame);
+        nes_ppu_draw(&frame, rom->chr, screen);
+    }
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    long length = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t *data = malloc(length > 0 ? (size_t)length : 1);
+    if (!data || (length > 0 && fread(data, 1, (size_t)length, in) != (size_t)length)) {
+        free(data);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+    *size = length > 0 ? (size_t)length : 0;
+    return data;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.nes [-m movie] [-n frames] [-w]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint8_t *movie_data = NULL;
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0) {
+            wait_for_renderer = true;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            movie_data = read_file(argv[++i], &movie_size);
+            if (!movie_data) {
+                fprintf(stderr, "cannot read %s\n", argv[i]);
+                return 2;
+            }
+            movie = movie_data;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            frame_count = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    const char *error;
+    rom = rom_map(argv[1], &error);
+    if (!rom) {
+        fprintf(stderr, "%s: %s\n", argv[1], error);
+        return 2;
+    }
+
+    double begin = now_seconds();
+    run_threaded();
+    double threaded = now_seconds() - begin;
+    begin = now_seconds();
+    run_inline();
+    double single = now_seconds() - begin;
+
+    printf("%lu frames: threaded %.3fs (%lu drawn, %lu dropped), inline %.3fs (%.2fx)\n",
+           (unsigned long)frame_count, threaded, (unsigned long)frames_drawn, (unsigned long)frames_dropped,
+           single, threaded > 0 ? single / threaded : 0.0);
+    nes_rom_release(rom);
+    free(movie_data);
+    return 0;
+}
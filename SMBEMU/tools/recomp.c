@@ -0,0 +1,531 @@
+/* Ahead-of-time recompiler for mapper-0 PRG. Runs on a PC:
+ *
+ *   cc -std=c99 -O2 -I../src -o recomp recomp.c ../src/nes_opcodes.c
+ *   ./recomp smb.nes ../src/nes_recomp_gen.c [options]
+ *
+ *   -e ADDR        extra entry point, e.g. a hot pc from SMBPROF
+ *   -t ADDR        jump-table dispatcher (SMB's JumpEngine): a JSR to it
+ *                  is followed by .dw targets rather than code
+ *   -r START-END   only emit blocks starting in this range; repeatable
+ *
+ * Code is traced from the reset, NMI and IRQ vectors. Each basic block
+ * becomes one C function. JMP (ind) is compiled: it reads its vector
+ * through the bus, with the 6502's page wrap, and ends the block there, but
+ * its targets are not traced, so add them with -e. Unofficial opcodes end
+ * a block and are left to the interpreter, as is everything not reached.
+ * Addresses are hex, with or without a leading $. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nes_opcodes.h"
+
+#define PRG_SIZE 0x8000
+#define MAX_BLOCK_INSNS 16
+#define MAX_TABLE_ENTRIES 64
+#define MAX_LIST 64
+
+static uint8_t prg[PRG_SIZE];
+static uint8_t queued[PRG_SIZE / 8];
+static uint16_t queue[PRG_SIZE];
+static uint16_t queue_count;
+static uint16_t tables[MAX_LIST];
+static uint16_t table_count;
+static uint16_t ranges[MAX_LIST][2];
+static uint16_t range_count;
+
+static uint8_t prg_byte(uint16_t addr) {
+    return prg[addr - 0x8000];
+}
+
+static uint16_t prg_word(uint16_t addr) {
+    return (uint16_t)(prg_byte(addr) | prg_byte((uint16_t)(addr + 1)) << 8);
+}
+
+static bool is_queued(uint16_t addr) {
+    uint16_t offset = addr - 0x8000;
+    return (queued[offset >> 3] >> (offset & 7)) & 1;
+}
+
+static void enqueue(uint16_t addr) {
+    if (addr < 0x8000 || is_queued(addr)) {
+        return;
+    }
+    uint16_t offset = addr - 0x8000;
+    queued[offset >> 3] |= (uint8_t)(1 << (offset & 7));
+    queue[queue_count++] = addr;
+}
+
+static bool is_table(uint16_t addr) {
+    for (uint16_t i = 0; i < table_count; i++) {
+        if (tables[i] == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool in_ranges(uint16_t addr) {
+    if (range_count == 0) {
+        return true;
+    }
+    for (uint16_t i = 0; i < range_count; i++) {
+        if (addr >= ranges[i][0] && addr <= ranges[i][1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool official(uint8_t opcode) {
+    return nes_opcode_names[opcode][0] != '?';
+}
+
+static bool is_branch(uint8_t opcode) {
+    return nes_opcode_modes[opcode] == NES_MODE_REL;
+}
+
+/* Opcodes after which the next pc is not simply the following byte. */
+static bool ends_block(uint8_t opcode) {
+    return is_branch(opcode) || opcode == 0x00 || opcode == 0x20 || opcode == 0x40 ||
+           opcode == 0x4C || opcode == 0x60 || opcode == 0x6C;
+}
+
+static bool fits(uint16_t pc, uint8_t opcode) {
+    return (uint32_t)pc + nes_mode_lengths[nes_opcode_modes[opcode]] <= 0x10000;
+}
+
+/* Walks one block from start and queues everything it can reach. */
+static void trace_block(uint16_t start) {
+    uint16_t pc = start;
+    for (int n = 0; n < MAX_BLOCK_INSNS; n++) {
+        uint8_t opcode = prg_byte(pc);
+        if (!official(opcode) || !fits(pc, opcode)) {
+            return;
+        }
+        uint16_t next = (uint16_t)(pc + nes_mode_lengths[nes_opcode_modes[opcode]]);
+        if (is_branch(opcode)) {
+            enqueue((uint16_t)(next + (int8_t)prg_byte((uint16_t)(pc + 1))));
+            enqueue(next);
+            return;
+        }
+        if (opcode == 0x20) {
+            uint16_t target = prg_word((uint16_t)(pc + 1));
+            enqueue(target);
+            if (!is_table(target)) {
+                enqueue(next);
+                return;
+            }
+            for (int i = 0; i < MAX_TABLE_ENTRIES && next >= 0x8000 && next < 0xFFFF; i++) {
+                uint16_t entry = prg_word(next);
+                if (entry < 0x8000) {
+                    break;
+                }
+                enqueue(entry);
+                next = (uint16_t)(next + 2);
+            }
+            return;
+        }
+        if (opcode == 0x4C) {
+            enqueue(prg_word((uint16_t)(pc + 1)));
+            return;
+        }
+        if (ends_block(opcode)) {
+            return;
+        }
+        if (next < 0x8000) {
+            return;
+        }
+        pc = next;
+    }
+    enqueue(pc);
+}
+
+/* A C expression for the byte an instruction reads. Constant RAM and PRG
+ * addresses skip the bus; PRG bytes are folded to literals. */
+static void read_expr(char *out, size_t size, uint8_t mode, uint16_t operand) {
+    const char *index = mode == NES_MODE_ABY || mode == NES_MODE_ZPY ? "cpu->y" : "cpu->x";
+    switch (mode) {
+    case NES_MODE_IMM:
+        snprintf(out, size, "0x%02X", operand);
+        break;
+    case NES_MODE_ZP:
+        snprintf(out, size, "nes->ram[0x%02X]", operand);
+        break;
+    case NES_MODE_ZPX:
+    case NES_MODE_ZPY:
+        snprintf(out, size, "nes->ram[(uint8_t)(0x%02X + %s)]", operand, index);
+        break;
+    case NES_MODE_ABS:
+        if (operand < 0x2000) {
+            snprintf(out, size, "nes->ram[0x%03X]", operand & 0x7FF);
+        } else if (operand >= 0x8000) {
+            snprintf(out, size, "0x%02X", prg_byte(operand));
+        } else {
+            snprintf(out, size, "nes_cpu_read(nes, 0x%04X)", operand);
+        }
+        break;
+    case NES_MODE_ABX:
+    case NES_MODE_ABY:
+        if (operand + 0xFF < 0x2000) {
+            snprintf(out, size, "nes->ram[(0x%04X + %s) & 0x7FF]", operand, index);
+        } else if (operand >= 0x8000 && operand + 0xFF <= 0xFFFF) {
+            snprintf(out, size, "nes->prg[0x%04X + %s]", operand - 0x8000, index);
+        } else {
+            snprintf(out, size, "nes_cpu_read(nes, (uint16_t)(0x%04X + %s))", operand, index);
+        }
+        break;
+    case NES_MODE_IZX:
+        snprintf(out, size, "nes_cpu_read(nes, R_IZX(0x%02X))", operand);
+        break;
+    default:
+        snprintf(out, size, "nes_cpu_read(nes, R_IZY(0x%02X))", operand);
+        break;
+    }
+}
+
+/* Either an lvalue in nes->ram (returns true) or a bus address expression. */
+static bool write_ref(char *out, size_t size, uint8_t mode, uint16_t operand) {
+    const char *index = mode == NES_MODE_ABY || mode == NES_MODE_ZPY ? "cpu->y" : "cpu->x";
+    switch (mode) {
+    case NES_MODE_ZP:
+        snprintf(out, size, "nes->ram[0x%02X]", operand);
+        return true;
+    case NES_MODE_ZPX:
+    case NES_MODE_ZPY:
+        snprintf(out, size, "nes->ram[(uint8_t)(0x%02X + %s)]", operand, index);
+        return true;
+    case NES_MODE_ABS:
+        if (operand < 0x2000) {
+            snprintf(out, size, "nes->ram[0x%03X]", operand & 0x7FF);
+            return true;
+        }
+        snprintf(out, size, "0x%04X", operand);
+        return false;
+    case NES_MODE_ABX:
+    case NES_MODE_ABY:
+        if (operand + 0xFF < 0x2000) {
+            snprintf(out, size, "nes->ram[(0x%04X + %s) & 0x7FF]", operand, index);
+            return true;
+        }
+        snprintf(out, size, "(uint16_t)(0x%04X + %s)", operand, index);
+        return false;
+    case NES_MODE_IZX:
+        snprintf(out, size, "R_IZX(0x%02X)", operand);
+        return false;
+    default:
+        snprintf(out, size, "R_IZY(0x%02X)", operand);
+        return false;
+    }
+}
+
+static const char *register_of(const char *name) {
+    char reg = name[2];
+    return reg == 'X' ? "cpu->x" : reg == 'Y' ? "cpu->y" : "cpu->a";
+}
+
+static bool named(const char *name, const char *list) {
+    for (const char *p = list; *p; p += 3) {
+        if (strncmp(name, p, 3) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *branch_condition(uint8_t opcode) {
+    switch (opcode) {
+    case 0x10: return "!(cpu->p & FLAG_N)";
+    case 0x30: return "cpu->p & FLAG_N";
+    case 0x50: return "!(cpu->p & FLAG_V)";
+    case 0x70: return "cpu->p & FLAG_V";
+    case 0x90: return "!(cpu->p & FLAG_C)";
+    case 0xB0: return "cpu->p & FLAG_C";
+    case 0xD0: return "!(cpu->p & FLAG_Z)";
+    default: return "cpu->p & FLAG_Z";
+    }
+}
+
+/* The extra cycle an indexed read takes when it crosses a page, added to
+ * R_CYCLES; empty for the other modes. */
+static void cross_expr(char *out, size_t size, uint8_t mode, uint16_t operand) {
+    if (mode == NES_MODE_ABX || mode == NES_MODE_ABY) {
+        snprintf(out, size, " + R_CROSS(0x%02X, %s)", operand & 0xFF, mode == NES_MODE_ABX ? "cpu->x" : "cpu->y");
+    } else if (mode == NES_MODE_IZY) {
+        snprintf(out, size, " + R_CROSS(nes->ram[0x%02X], cpu->y)", operand);
+    } else {
+        out[0] = '\0';
+    }
+}
+
+/* Emits one instruction. Returns false when it ended the block. */
+static bool emit_insn(FILE *out, uint16_t pc) {
+    uint8_t opcode = prg_byte(pc);
+    uint8_t mode = nes_opcode_modes[opcode];
+    uint8_t cycles = nes_opcode_cycles[opcode];
+    const char *name = nes_opcode_names[opcode];
+    uint16_t next = (uint16_t)(pc + nes_mode_lengths[mode]);
+    uint16_t operand = 0;
+    char expr[96];
+    char penalty[48] = "";
+
+    if (nes_mode_lengths[mode] == 2) {
+        operand = prg_byte((uint16_t)(pc + 1));
+    } else if (nes_mode_lengths[mode] == 3) {
+        operand = prg_word((uint16_t)(pc + 1));
+    }
+    fprintf(out, "    /* %04X %s */\n", pc, name);
+
+    if (is_branch(opcode)) {
+        uint16_t target = (uint16_t)(next + (int8_t)operand);
+        fprintf(out, "    R_CYCLES(%u);\n", cycles);
+        fprintf(out, "    if (%s) {\n        R_CYCLES(%u);\n        R_EXIT(0x%04X);\n    }\n",
+                branch_condition(opcode), ((target ^ next) & 0xFF00) ? 2 : 1, target);
+        fprintf(out, "    R_EXIT(0x%04X);\n", next);
+        return false;
+    }
+    switch (opcode) {
+    case 0x00:
+        fprintf(out, "    R_PUSH(0x%02X);\n    R_PUSH(0x%02X);\n", (uint16_t)(pc + 2) >> 8, (pc + 2) & 0xFF);
+        fprintf(out, "    R_PUSH(cpu->p | FLAG_B);\n    cpu->p |= FLAG_I;\n");
+        fprintf(out, "    R_CYCLES(%u);\n    R_EXIT(0x%04X);\n", cycles, prg_word(0xFFFE));
+        return false;
+    case 0x20:
+        fprintf(out, "    R_PUSH(0x%02X);\n    R_PUSH(0x%02X);\n", (uint16_t)(pc + 2) >> 8, (pc + 2) & 0xFF);
+        fprintf(out, "    R_CYCLES(%u);\n    R_EXIT(0x%04X);\n", cycles, operand);
+        return false;
+    case 0x40:
+        fprintf(out, "    cpu->p = R_POP() | FLAG_U;\n");
+        fprintf(out, "    {\n        uint16_t r_pc = R_POP();\n        r_pc |= (uint16_t)(R_POP() << 8);\n");
+        fprintf(out, "        R_CYCLES(%u);\n        R_UNMASK(r_pc);\n        R_EXIT(r_pc);\n    }\n", cycles);
+        return false;
+    case 0x4C:
+        fprintf(out, "    R_CYCLES(%u);\n    R_EXIT(0x%04X);\n", cycles, operand);
+        return false;
+    case 0x60:
+        fprintf(out, "    {\n        uint16_t r_pc = R_POP();\n        r_pc |= (uint16_t)(R_POP() << 8);\n");
+        fprintf(out, "        R_CYCLES(%u);\n        R_EXIT((uint16_t)(r_pc + 1));\n    }\n", cycles);
+        return false;
+    case 0x6C:
+        fprintf(out, "    {\n        uint16_t r_pc = nes_cpu_read(nes, 0x%04X);\n", operand);
+        fprintf(out, "        r_pc |= (uint16_t)(nes_cpu_read(nes, 0x%04X) << 8);\n",
+                (operand & 0xFF00) | ((operand + 1) & 0xFF));
+        fprintf(out, "        R_CYCLES(%u);\n        R_EXIT(r_pc);\n    }\n", cycles);
+        return false;
+    case 0x08:
+        fprintf(out, "    R_PUSH(cpu->p | FLAG_B | FLAG_U);\n");
+        break;
+    case 0x28:
+        fprintf(out, "    cpu->p = R_POP() | FLAG_U;\n    R_CYCLES(%u);\n    R_UNMASK(0x%04X);\n", cycles, next);
+        return true;
+    case 0x48:
+        fprintf(out, "    R_PUSH(cpu->a);\n");
+        break;
+    case 0x68:
+        fprintf(out, "    cpu->a = R_POP();\n    R_ZN(cpu->a);\n");
+        break;
+    case 0x18: fprintf(out, "    cpu->p &= ~FLAG_C;\n"); break;
+    case 0x38: fprintf(out, "    cpu->p |= FLAG_C;\n"); break;
+    case 0x58:
+        fprintf(out, "    cpu->p &= ~FLAG_I;\n    R_CYCLES(%u);\n    R_UNMASK(0x%04X);\n", cycles, next);
+        return true;
+    case 0x78: fprintf(out, "    cpu->p |= FLAG_I;\n"); break;
+    case 0xB8: fprintf(out, "    cpu->p &= ~FLAG_V;\n"); break;
+    case 0xD8: fprintf(out, "    cpu->p &= ~FLAG_D;\n"); break;
+    case 0xF8: fprintf(out, "    cpu->p |= FLAG_D;\n"); break;
+    case 0xAA: fprintf(out, "    cpu->x = cpu->a;\n    R_ZN(cpu->x);\n"); break;
+    case 0xA8: fprintf(out, "    cpu->y = cpu->a;\n    R_ZN(cpu->y);\n"); break;
+    case 0x8A: fprintf(out, "    cpu->a = cpu->x;\n    R_ZN(cpu->a);\n"); break;
+    case 0x98: fprintf(out, "    cpu->a = cpu->y;\n    R_ZN(cpu->a);\n"); break;
+    case 0xBA: fprintf(out, "    cpu->x = cpu->sp;\n    R_ZN(cpu->x);\n"); break;
+    case 0x9A: fprintf(out, "    cpu->sp = cpu->x;\n"); break;
+    case 0xE8: fprintf(out, "    R_INC(cpu->x);\n"); break;
+    case 0xC8: fprintf(out, "    R_INC(cpu->y);\n"); break;
+    case 0xCA: fprintf(out, "    R_DEC(cpu->x);\n"); break;
+    case 0x88: fprintf(out, "    R_DEC(cpu->y);\n"); break;
+    case 0xEA: break;
+    default:
+        if (mode == NES_MODE_ACC) {
+            fprintf(out, "    R_%s(cpu->a);\n", name);
+        } else if (named(name, "LDALDXLDY")) {
+            read_expr(expr, sizeof(expr), mode, operand);
+            cross_expr(penalty, sizeof(penalty), mode, operand);
+            fprintf(out, "    %s = %s;\n    R_ZN(%s);\n", register_of(name), expr, register_of(name));
+        } else if (named(name, "ORAANDEOR")) {
+            const char *op = name[0] == 'O' ? "|" : name[0] == 'A' ? "&" : "^";
+            read_expr(expr, sizeof(expr), mode, operand);
+            cross_expr(penalty, sizeof(penalty), mode, operand);
+            fprintf(out, "    cpu->a %s= %s;\n    R_ZN(cpu->a);\n", op, expr);
+        } else if (named(name, "ADCSBCBIT")) {
+            read_expr(expr, sizeof(expr), mode, operand);
+            cross_expr(penalty, sizeof(penalty), mode, operand);
+            fprintf(out, "    R_%s(%s);\n", name, expr);
+        } else if (named(name, "CMPCPXCPY")) {
+            read_expr(expr, sizeof(expr), mode, operand);
+            cross_expr(penalty, sizeof(penalty), mode, operand);
+            fprintf(out, "    R_CMP(%s, %s);\n", register_of(name), expr);
+        } else if (named(name, "STASTXSTY")) {
+            if (write_ref(expr, sizeof(expr), mode, operand)) {
+                fprintf(out, "    %s = %s;\n", expr, register_of(name));
+            } else {
+                fprintf(out, "    nes_cpu_write(nes, %s, %s);\n", expr, register_of(name));
+            }
+        } else if (write_ref(expr, sizeof(expr), mode, operand)) {
+            fprintf(out, "    R_%s(%s);\n", name, expr);
+        } else {
+            fprintf(out, "    {\n        uint16_t r_addr = %s;\n", expr);
+            fprintf(out, "        uint8_t r_m = nes_cpu_read(nes, r_addr);\n");
+            fprintf(out, "        R_%s(r_m);\n        nes_cpu_write(nes, r_addr, r_m);\n    }\n", name);
+        }
+        break;
+    }
+    fprintf(out, "    R_CYCLES(%u%s);\n", cycles, penalty);
+    return true;
+}
+
+static void emit_block(FILE *out, uint16_t start) {
+    uint16_t pc = start;
+    fprintf(out, "static void block_%04X(nes_t *nes, uint32_t deadline) {\n", start);
+    fprintf(out, "    nes_cpu_t *cpu = &nes->cpu;\n    (void)deadline;\n");
+    for (int n = 0; n < MAX_BLOCK_INSNS; n++) {
+        uint8_t opcode = prg_byte(pc);
+        if (!official(opcode) || !fits(pc, opcode)) {
+            break;
+        }
+        if (n > 0) {
+            fprintf(out, "    R_CHECK(0x%04X);\n", pc);
+        }
+        if (!emit_insn(out, pc)) {
+            fprintf(out, "}\n\n");
+            return;
+        }
+        pc = (uint16_t)(pc + nes_mode_lengths[nes_opcode_modes[opcode]]);
+        if (pc < 0x8000) {
+            break;
+        }
+    }
+    fprintf(out, "    R_EXIT(0x%04X);\n}\n\n", pc);
+}
+
+static int compare_addr(const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+static bool parse_addr(const char *text, uint16_t *addr) {
+    char *end;
+    if (*text == '$') {
+        text++;
+    }
+    unsigned long value = strtoul(text, &end, 16);
+    if (end == text || value > 0xFFFF) {
+        return false;
+    }
+    *addr = (uint16_t)value;
+    return true;
+}
+
+static bool load_rom(const char *path) {
+    uint8_t header[16];
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+              memcmp(header, "NES\x1A", 4) == 0 && (header[4] == 1 || header[4] == 2);
+    if (ok && (header[6] & 0x04)) {
+        ok = fseek(file, 512, SEEK_CUR) == 0;
+    }
+    if (ok) {
+        size_t size = (size_t)header[4] * 0x4000;
+        ok = fread(prg, 1, size, file) == size;
+        if (size == 0x4000) {
+            memcpy(prg + 0x4000, prg, 0x4000);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint16_t entries[MAX_LIST];
+    uint16_t entry_count = 0;
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s rom.nes out.c [-e addr] [-t addr] [-r start-end]\n", argv[0]);
+        return 1;
+    }
+    for (int i = 3; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[++i] : "";
+        bool ok;
+        if (strcmp(arg, "-e") == 0 && entry_count < MAX_LIST) {
+            ok = parse_addr(value, &entries[entry_count++]);
+        } else if (strcmp(arg, "-t") == 0 && table_count < MAX_LIST) {
+            ok = parse_addr(value, &tables[table_count++]);
+        } else if (strcmp(arg, "-r") == 0 && range_count < MAX_LIST) {
+            const char *dash = strchr(value, '-');
+            ok = dash && parse_addr(value, &ranges[range_count][0]) &&
+                 parse_addr(dash + 1, &ranges[range_count][1]);
+            range_count++;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "bad option %s %s\n", arg, value);
+            return 1;
+        }
+    }
+    if (!load_rom(argv[1])) {
+        fprintf(stderr, "%s: not a 16 or 32 KB NROM image\n", argv[1]);
+        return 1;
+    }
+
+    enqueue(prg_word(0xFFFC));
+    enqueue(prg_word(0xFFFA));
+    enqueue(prg_word(0xFFFE));
+    for (uint16_t i = 0; i < entry_count; i++) {
+        enqueue(entries[i]);
+    }
+    for (uint16_t i = 0; i < queue_count; i++) {
+        trace_block(queue[i]);
+    }
+
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < queue_count; i++) {
+        if (in_ranges(queue[i]) && official(prg_byte(queue[i])) && fits(queue[i], prg_byte(queue[i]))) {
+            queue[count++] = queue[i];
+        }
+    }
+    qsort(queue, count, sizeof(queue[0]), compare_addr);
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(out, "/* Generated by tools/recomp.c from %s. Do not edit. */\n\n", argv[1]);
+    fprintf(out, "#include \"nes_recomp.h\"\n\n#ifdef NES_RECOMP\n\n");
+    for (uint16_t i = 0; i < count; i++) {
+        emit_block(out, queue[i]);
+    }
+    fprintf(out, "const nes_block_t nes_recomp_blocks[] = {\n");
+    for (uint16_t i = 0; i < count; i++) {
+        fprintf(out, "    { 0x%04X, block_%04X }%s\n", queue[i], queue[i], i + 1 < count ? "," : "");
+    }
+    fprintf(out, "};\n\nconst uint16_t nes_recomp_block_count = %u;\n\n", count);
+
+    memset(queued, 0, sizeof(queued));
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t offset = queue[i] - 0x8000;
+        queued[offset >> 3] |= (uint8_t)(1 << (offset & 7));
+    }
+    fprintf(out, "const uint8_t nes_recomp_starts[0x1000] = {");
+    for (int i = 0; i < 0x1000; i++) {
+        fprintf(out, "%s0x%02X%s", i % 16 ? " " : "\n    ", queued[i], i + 1 < 0x1000 ? "," : "");
+    }
+    fprintf(out, "\n};\n\n#endif\n");
+    fclose(out);
+    printf("%u blocks\n", count);
+    return 0;
+}
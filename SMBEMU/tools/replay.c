@@ -0,0 +1,315 @@
+/* Replays an input movie and checks every frame against a golden hash
+ * list, the host side of FRAMEHASH=YES. Runs on a PC:
+ *
+ *   cc -std=c99 -O2 -Ihost -I../src -o replay replay.c host/rom_map.c \
+ *      ../src/nes_movie.c ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c \
+ *      ../src/nes_sched.c ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c
+ *   ./replay smb.nes movie [options]
+ *
+ *   -g FILE        golden list, 16 hex digits per line (SMBHASH format)
+ *   -o FILE        write this run's hashes, to keep as a new golden list
+ *   -d DIR         where mismatching frames go as frame_NNNNN.png
+ *                  (default .)
+ *   -k N           PNGs to write at most (default 16)
+ *   -f FILE        also write every frame as 256x240 palette indices, the
+ *                  input format of tools/export.c; "-" is stdout, and the
+ *                  report then goes to stderr
+ *
+ * The movie is one controller byte per frame (SMBMOVIE). Each frame is run,
+ * captured and drawn into a cleared 320x240 buffer the way FRAMEHASH=YES
+ * does on the calculator, and hashed with nes_ppu_frame_hash, so lists from
+ * either side can be compared with the other. A mismatching frame is
+ * written as a 256x240 PNG through the NES palette. The exit status is 1 on
+ * any mismatch.
+ *
+ * The PNG writer uses stored (uncompressed) deflate blocks, so it needs no
+ * zlib; a frame is about 180 KB. A replay becomes a video with
+ *
+ *   ./replay smb.nes movie -f - | ./export - run.y4m */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "nes_movie.h"
+#include "nes_palette.h"
+#include "rom_map.h"
+
+#define SCREEN_BYTES (320 * NES_SCREEN_HEIGHT)
+#define ROW_BYTES (1 + NES_SCREEN_WIDTH * 3)
+#define IMAGE_BYTES (ROW_BYTES * NES_SCREEN_HEIGHT)
+#define STORED_MAX 0xFFFF
+
+static uint32_t crc_table[256];
+
+static void build_crc_table(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t adler32(const uint8_t *data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+static void put_be32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static void write_chunk(FILE *out, const char *type, const uint8_t *data, size_t size) {
+    uint8_t word[4];
+    put_be32(word, (uint32_t)size);
+    fwrite(word, 1, 4, out);
+    fwrite(type, 1, 4, out);
+    fwrite(data, 1, size, out);
+    uint32_t crc = crc_update(0xFFFFFFFFu, (const uint8_t *)type, 4);
+    crc = crc_update(crc, data, size) ^ 0xFFFFFFFFu;
+    put_be32(word, crc);
+    fwrite(word, 1, 4, out);
+}
+
+/* Writes the 256 picture columns of a 320x240 draw buffer as an RGB PNG:
+ * one zlib stream of stored blocks, each up to 65535 bytes behind a
+ * 5-byte header, in a single IDAT. */
+static bool write_png(const char *path, const uint8_t *buffer) {
+    static uint8_t image[IMAGE_BYTES];
+    static uint8_t idat[2 + IMAGE_BYTES + 5 * (IMAGE_BYTES / STORED_MAX + 1) + 4];
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    const uint8_t *row = buffer + (320 - NES_SCREEN_WIDTH) / 2;
+    uint8_t *pixel = image;
+    for (int y = 0; y < NES_SCREEN_HEIGHT; y++) {
+        *pixel++ = 0; /* filter: none */
+        for (int x = 0; x < NES_SCREEN_WIDTH; x++) {
+            uint32_t rgb = nes_palette_rgb[row[x] & 0x3F];
+            *pixel++ = (uint8_t)(rgb >> 16);
+            *pixel++ = (uint8_t)(rgb >> 8);
+            *pixel++ = (uint8_t)rgb;
+        }
+        row += 320;
+    }
+
+    size_t size = 0;
+    idat[size++] = 0x78;
+    idat[size++] = 0x01;
+    for (size_t done = 0; done < IMAGE_BYTES;) {
+        size_t length = IMAGE_BYTES - done < STORED_MAX ? IMAGE_BYTES - done : STORED_MAX;
+        idat[size++] = done + length == IMAGE_BYTES ? 1 : 0;
+        idat[size++] = (uint8_t)length;
+        idat[size++] = (uint8_t)(length >> 8);
+        idat[size++] = (uint8_t)~length;
+        idat[size++] = (uint8_t)(~length >> 8);
+        memcpy(idat + size, image + done, length);
+        size += length;
+        done += length;
+    }
+    put_be32(idat + size, adler32(image, IMAGE_BYTES));
+    size += 4;
+
+    uint8_t header[13];
+    put_be32(header, NES_SCREEN_WIDTH);
+    put_be32(header + 4, NES_SCREEN_HEIGHT);
+    header[8] = 8;  /* bit depth */
+    header[9] = 2;  /* truecolour */
+    header[10] = 0; /* deflate */
+    header[11] = 0; /* adaptive filtering */
+    header[12] = 0; /* no interlace */
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        return false;
+    }
+    fwrite(signature, 1, sizeof(signature), out);
+    write_chunk(out, "IHDR", header, sizeof(header));
+    write_chunk(out, "IDAT", idat, size);
+    write_chunk(out, "IEND", NULL, 0);
+    return fclose(out) == 0;
+}
+
+/* The 256 picture columns of a 320x240 draw buffer, row after row. */
+static bool write_frame(FILE *out, const uint8_t *buffer) {
+    const uint8_t *row = buffer + (320 - NES_SCREEN_WIDTH) / 2;
+    for (int y = 0; y < NES_SCREEN_HEIGHT; y++) {
+        if (fwrite(row, 1, NES_SCREEN_WIDTH, out) != NES_SCREEN_WIDTH) {
+            return false;
+        }
+        row += 320;
+    }
+    return true;
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    long length = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t *data = malloc(length > 0 ? (size_t)length : 1);
+    if (!data || (length > 0 && fread(data, 1, (size_t)length, in) != (size_t)length)) {
+        free(data);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+    *size = length > 0 ? (size_t)length : 0;
+    return data;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.nes movie [-g golden] [-o hashes] [-d dir] [-k count] [-f frames]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static nes_t nes;
+    static nes_ppu_frame_t frame;
+    static nes_movie_t movie;
+    static uint8_t screen[SCREEN_BYTES];
+    const char *golden_path = NULL;
+    const char *hash_path = NULL;
+    const char *dump_dir = ".";
+    const char *frame_path = NULL;
+    unsigned long dump_limit = 16;
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+    for (int i = 3; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || !argv[i][1] || !strchr("godkf", argv[i][1]) || argv[i][2]) {
+            usage(argv[0]);
+        }
+        const char *value = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'g': golden_path = value; break;
+        case 'o': hash_path = value; break;
+        case 'd': dump_dir = value; break;
+        case 'f': frame_path = value; break;
+        default: dump_limit = strtoul(value, NULL, 0); break;
+        }
+    }
+
+    const char *error;
+    nes_rom_t *rom = rom_map(argv[1], &error);
+    if (!rom) {
+        fprintf(stderr, "%s: %s\n", argv[1], error);
+        return 2;
+    }
+    size_t movie_size;
+    uint8_t *inputs = read_file(argv[2], &movie_size);
+    if (!inputs) {
+        fprintf(stderr, "cannot read %s\n", argv[2]);
+        return 2;
+    }
+    size_t golden_size = 0;
+    char *golden = NULL;
+    if (golden_path) {
+        golden = (char *)read_file(golden_path, &golden_size);
+        if (!golden) {
+            fprintf(stderr, "cannot read %s\n", golden_path);
+            return 2;
+        }
+    }
+    FILE *hashes = NULL;
+    if (hash_path) {
+        hashes = fopen(hash_path, "w");
+        if (!hashes) {
+            fprintf(stderr, "cannot write %s\n", hash_path);
+            return 2;
+        }
+    }
+    FILE *frames = NULL;
+    FILE *report = stdout;
+    if (frame_path) {
+        frames = strcmp(frame_path, "-") == 0 ? stdout : fopen(frame_path, "wb");
+        if (!frames) {
+            fprintf(stderr, "cannot write %s\n", frame_path);
+            return 2;
+        }
+        if (frames == stdout) {
+            report = stderr;
+        }
+    }
+    build_crc_table();
+
+    nes_init(&nes, rom);
+    nes_sched_reset(&nes);
+    nes_ppu_reset(&nes);
+    nes_cpu_reset(&nes);
+    nes_apu_reset(&nes);
+    nes_movie_start(&movie, inputs, (uint32_t)movie_size, golden, golden_size);
+    nes_set_input_provider(&nes, nes_movie_input, &movie);
+
+    unsigned long dumped = 0;
+    while (!nes_movie_done(&movie)) {
+        uint32_t index = movie.frame;
+        nes_cpu_run(&nes, NES_FRAME_CYCLES);
+        nes_ppu_capture(&nes, &frame);
+        memset(screen, 0, sizeof(screen));
+        nes_ppu_draw(&frame, nes.chr, screen);
+        uint64_t hash = nes_ppu_frame_hash(screen);
+        if (frames && !write_frame(frames, screen)) {
+            fprintf(stderr, "cannot write %s\n", frame_path);
+            return 2;
+        }
+        if (hashes) {
+            char line[17];
+            nes_movie_format_hash(hash, line);
+            fprintf(hashes, "%s\n", line);
+        }
+        if (!nes_movie_check(&movie, hash) && dumped < dump_limit) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/frame_%05lu.png", dump_dir, (unsigned long)index);
+            if (!write_png(path, screen)) {
+                fprintf(stderr, "cannot write %s\n", path);
+            }
+            dumped++;
+        }
+    }
+
+    fprintf(report, "%lu frames, %lu checked, %lu mismatched", (unsigned long)movie.frames,
+            (unsigned long)movie.checked, (unsigned long)movie.mismatches);
+    if (movie.mismatches) {
+        fprintf(report, ", first at frame %lu, %lu written as PNG", (unsigned long)movie.first_mismatch, dumped);
+    }
+    fprintf(report, "\n");
+    if (frames && fclose(frames) != 0) {
+        fprintf(stderr, "cannot write %s\n", frame_path);
+        return 2;
+    }
+    if (hashes) {
+        fclose(hashes);
+    }
+    free(golden);
+    free(inputs);
+    nes_rom_release(rom);
+    return movie.mismatches ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/* Compresses an iNES ROM for the SMBROM AppVar. Runs on a PC:
+ *
+ *   cc -std=c99 -O2 -I../src -o romz romz.c ../src/nes_rom.c
+ *   ./romz smb.nes smb.nesz
+ *
+ * The output is "NESZ", the iNES header with the trainer flag cleared, and
+ * PRG followed by CHR as one LZ4 block. rom_load_smb takes either this or
+ * the plain .nes in SMBROM, so it is packed into an AppVar the same way.
+ * The block follows LZ4's end-of-block rules, so a stock LZ4 block encoder
+ * can produce it too. Every output is decoded again with the emulator's
+ * own loader and compared before it is written. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nes_rom.h"
+
+#define MAX_INPUT (NES_PRG_SIZE + NES_CHR_SIZE)
+#define MAX_OUTPUT (MAX_INPUT + MAX_INPUT / 255 + 64)
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xFFFF
+#define HASH_BITS 14
+#define MAX_CHAIN 1024
+/* LZ4 keeps the last 5 bytes as literals and starts no match in the last
+ * 12, so decoders may copy in wide words without checking every byte. */
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+
+static uint8_t file[0x20000];
+static uint8_t data[MAX_INPUT];
+static uint8_t out[NES_ROM_PACKED_MAGIC_SIZE + NES_ROM_HEADER_SIZE + MAX_OUTPUT];
+static int32_t head[1 << HASH_BITS];
+static int32_t chain[MAX_INPUT];
+
+static uint32_t hash4(const uint8_t *p) {
+    uint32_t value = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void insert(size_t pos) {
+    uint32_t h = hash4(data + pos);
+    chain[pos] = head[h];
+    head[h] = (int32_t)pos;
+}
+
+/* Longest earlier match for pos that ends before limit. */
+static size_t find_match(size_t pos, size_t limit, size_t *offset) {
+    size_t best = 0;
+    int32_t candidate = head[hash4(data + pos)];
+    for (int depth = 0; candidate >= 0 && depth < MAX_CHAIN; depth++) {
+        size_t from = (size_t)candidate;
+        if (pos - from > MAX_OFFSET) {
+            break;
+        }
+        size_t length = 0;
+        while (pos + length < limit && data[from + length] == data[pos + length]) {
+            length++;
+        }
+        if (length > best) {
+            best = length;
+            *offset = pos - from;
+        }
+        candidate = chain[from];
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+static uint8_t *put_length(uint8_t *p, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *p++ = 255;
+    }
+    *p++ = (uint8_t)length;
+    return p;
+}
+
+static uint8_t *put_sequence(uint8_t *p, const uint8_t *literals, size_t literal_count, size_t offset,
+                             size_t match) {
+    uint8_t *token = p++;
+    *token = (uint8_t)((literal_count >= 15 ? 15 : literal_count) << 4);
+    if (literal_count >= 15) {
+        p = put_length(p, literal_count - 15);
+    }
+    memcpy(p, literals, literal_count);
+    p += literal_count;
+    if (match) {
+        *p++ = (uint8_t)offset;
+        *p++ = (uint8_t)(offset >> 8);
+        size_t extra = match - MIN_MATCH;
+        *token |= (uint8_t)(extra >= 15 ? 15 : extra);
+        if (extra >= 15) {
+            p = put_length(p, extra - 15);
+        }
+    }
+    return p;
+}
+
+/* Greedy parse with one step of lazy matching over hash chains. */
+static size_t compress(size_t size, uint8_t *dst) {
+    uint8_t *p = dst;
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t limit = size > LAST_LITERALS ? size - LAST_LITERALS : 0;
+    memset(head, 0xFF, sizeof(head));
+    while (size >= MATCH_LIMIT && pos + MATCH_LIMIT <= size) {
+        size_t offset = 0;
+        size_t match = find_match(pos, limit, &offset);
+        if (match) {
+            size_t next_offset = 0;
+            insert(pos);
+            if (pos + 1 + MATCH_LIMIT <= size && find_match(pos + 1, limit, &next_offset) > match) {
+                pos++;
+                continue;
+            }
+            p = put_sequence(p, data + anchor, pos - anchor, offset, match);
+            for (size_t i = pos + 1; i < pos + match && i + MIN_MATCH <= size; i++) {
+                insert(i);
+            }
+            pos += match;
+            anchor = pos;
+        } else {
+            insert(pos);
+            pos++;
+        }
+    }
+    p = put_sequence(p, data + anchor, size - anchor, 0, 0);
+    return (size_t)(p - dst);
+}
+
+int main(int argc, char **argv) {
+    static nes_rom_banks_t plain_banks;
+    static nes_rom_banks_t packed_banks;
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s rom.nes out.nesz\n", argv[0]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    size_t file_size = fread(file, 1, sizeof(file), in);
+    fclose(in);
+
+    nes_rom_t plain;
+    const char *error;
+    if (!nes_rom_parse(&plain, file, file_size, &plain_banks, &error)) {
+        fprintf(stderr, "%s: %s\n", argv[1], error);
+        return 1;
+    }
+    size_t prg_size = (size_t)file[4] * 0x4000;
+    memcpy(data, plain_banks.prg, prg_size);
+    memcpy(data + prg_size, plain_banks.chr, NES_CHR_SIZE);
+
+    memcpy(out, NES_ROM_PACKED_MAGIC, NES_ROM_PACKED_MAGIC_SIZE);
+    memcpy(out + NES_ROM_PACKED_MAGIC_SIZE, file, NES_ROM_HEADER_SIZE);
+    out[NES_ROM_PACKED_MAGIC_SIZE + 6] &= (uint8_t)~0x04;
+    size_t size = NES_ROM_PACKED_MAGIC_SIZE + NES_ROM_HEADER_SIZE;
+    size += compress(prg_size + NES_CHR_SIZE, out + size);
+
+    nes_rom_t packed;
+    if (!nes_rom_parse(&packed, out, size, &packed_banks, &error) ||
+        memcmp(&plain_banks, &packed_banks, sizeof(plain_banks)) != 0 || plain.mirroring != packed.mirroring) {
+        fprintf(stderr, "round trip failed: %s\n", error ? error : "contents differ");
+        return 1;
+    }
+    FILE *dst = fopen(argv[2], "wb");
+    if (!dst || fwrite(out, 1, size, dst) != size) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fclose(dst);
+    printf("%lu -> %lu bytes (%lu%%)\n", (unsigned long)file_size, (unsigned long)size,
+           (unsigned long)(size * 100 / file_size));
+    return 0;
+}
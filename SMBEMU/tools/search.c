@@ -0,0 +1,539 @@
+/* Best-first search over controller inputs, for route finding and
+ * automated playtesting. Runs on a PC:
+ *
+ *   cc -std=c11 -O2 -pthread -Ihost -I../src -o search search.c host/rom_map.c \
+ *      ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c ../src/nes_sched.c \
+ *      ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c
+ *   ./search smb.nes [options]
+ *
+ *   -m FILE        replay this movie first and search from where it ends
+ *   -o FILE        write the best route found, prefix included (default
+ *                  route.mov)
+ *   -j N           worker threads (default 4)
+ *   -n N           stop after expanding N states (default 20000)
+ *   -k N           frames each input is held for (default 8)
+ *   -d N           deepest route, in held inputs (default 256)
+ *   -f N           most states kept on the frontier (default 4096)
+ *   -i LIST        inputs to try, hex controller bytes separated by commas
+ *                  (default 00,80,81,82,83,41)
+ *   -s ADDR        score by this RAM byte, most significant first;
+ *                  repeatable, up to 4. Without it the score is SMB's
+ *                  progress and dead branches are pruned.
+ *
+ * Movies are one controller byte per frame, the SMBMOVIE format, so a
+ * route can be replayed on the calculator with FRAMEHASH=YES.
+ *
+ * Each worker takes the best state off the frontier, copies it once per
+ * input and runs every copy for one held input. nes_cpu_run never draws;
+ * pixels only come from nes_ppu_capture, which the search never calls, so
+ * a step costs the CPU and scheduler and nothing else. A copy is a plain
+ * nes_t assignment: the ROM is mapped once and shared, and only the input
+ * binding has to be redone. Children whose RAM and PPU state hash the same as one already
+ * seen are dropped, which folds the many inputs that make no difference
+ * on a given frame into one branch. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "rom_map.h"
+
+#if defined(NES_PROFILE) || defined(NES_DEBUG) || defined(NES_PERF)
+#error "PROFILE, DEBUG and PERF keep global state that the search threads would share"
+#endif
+
+#define MAX_THREADS 64
+#define MAX_INPUTS 16
+#define MAX_SCORE_BYTES 4
+#define NO_PARENT UINT32_MAX
+
+/* SMB RAM: world and level, the player's page and x within it, the
+ * engine routine (0x0B while dying), the vertical page (past 1 means
+ * fallen into a pit) and the lives left. */
+#define SMB_WORLD 0x075F
+#define SMB_LEVEL 0x075C
+#define SMB_PAGE 0x006D
+#define SMB_X 0x0086
+#define SMB_ENGINE 0x000E
+#define SMB_ENGINE_DYING 0x0B
+#define SMB_Y_PAGE 0x00B5
+#define SMB_LIVES 0x075A
+
+/* One searched state. The trail (parent, input, depth) is kept for every
+ * state so the route can be rebuilt; the nes_t only while it is on the
+ * frontier. */
+typedef struct {
+    uint32_t parent;
+    uint16_t depth;
+    uint8_t input;
+} trail_t;
+
+typedef struct {
+    uint32_t score;
+    uint32_t node;
+    nes_t *state;
+} entry_t;
+
+typedef struct {
+    nes_t scratch;
+    uint8_t input;
+    uint32_t expanded;
+    uint32_t children;
+    uint32_t duplicates;
+    uint32_t deaths;
+} worker_t;
+
+static nes_rom_t *rom;
+static uint8_t inputs[MAX_INPUTS] = { 0x00, 0x80, 0x81, 0x82, 0x83, 0x41 };
+static unsigned int input_count = 6;
+static uint16_t score_addrs[MAX_SCORE_BYTES];
+static unsigned int score_count;
+static unsigned int hold = 8;
+static unsigned int max_depth = 256;
+static uint32_t max_expansions = 20000;
+static uint32_t frontier_size = 4096;
+static uint8_t start_lives;
+
+static trail_t *trail;
+static uint32_t trail_capacity;
+static atomic_uint trail_count;
+
+/* Seen states, open addressing on the 64-bit hash. 0 marks a free slot. */
+static _Atomic uint64_t *seen;
+static uint64_t seen_mask;
+
+/* The frontier: a max-heap on score under one lock. Expanding a state
+ * runs hold frames per input, so workers hold the lock for a tiny
+ * fraction of their time. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static entry_t *heap;
+static uint32_t heap_count;
+static unsigned int busy;
+static uint32_t expansions;
+static bool stopping;
+static uint32_t best_score;
+static uint32_t best_node;
+static uint64_t rng_state = 0x9E3779B97F4A7C15u;
+
+static uint8_t held_input(void *ctx) {
+    return *(const uint8_t *)ctx;
+}
+
+static uint64_t mix64(uint64_t h, uint64_t word) {
+    h ^= word * 0x9E3779B97F4A7C15u;
+    h = (h << 27 | h >> 37) * 0xBF58476D1CE4E5B9u;
+    return h;
+}
+
+static uint64_t hash_bytes(uint64_t h, const uint8_t *data, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = mix64(h, word);
+    }
+    for (; i < size; i++) {
+        h = mix64(h, data[i]);
+    }
+    return h;
+}
+
+/* RAM plus everything the PPU shows or will show. Fields are hashed one
+ * by one so struct padding never makes equal states differ. */
+static uint64_t hash_state(const nes_t *nes) {
+    const nes_ppu_t *ppu = &nes->ppu;
+    uint64_t h = hash_bytes(0, nes->ram, NES_RAM_SIZE);
+    h = hash_bytes(h, ppu->nametable, NES_NAMETABLE_SIZE);
+    h = hash_bytes(h, ppu->oam, NES_OAM_SIZE);
+    h = hash_bytes(h, ppu->palette, NES_PALETTE_SIZE);
+    uint8_t regs[8] = { ppu->ctrl, ppu->mask, ppu->scroll_x, ppu->scroll_y, ppu->fine_x,
+                        (uint8_t)ppu->vram_addr, (uint8_t)(ppu->vram_addr >> 8), ppu->addr_latch };
+    h = hash_bytes(h, regs, sizeof(regs));
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+/* Returns false when hash was already in the set. A full set accepts
+ * everything rather than stalling the search. */
+static bool insert_seen(uint64_t hash) {
+    uint64_t index = hash & seen_mask;
+    for (uint64_t probe = 0; probe <= seen_mask; probe++) {
+        uint64_t expected = 0;
+        _Atomic uint64_t *slot = &seen[(index + probe) & seen_mask];
+        if (atomic_compare_exchange_strong(slot, &expected, hash)) {
+            return true;
+        }
+        if (expected == hash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool smb_dead(const nes_t *nes) {
+    return nes->ram[SMB_ENGINE] == SMB_ENGINE_DYING || nes->ram[SMB_Y_PAGE] > 1 ||
+           nes->ram[SMB_LIVES] < start_lives;
+}
+
+static uint32_t score_state(const nes_t *nes) {
+    if (score_count == 0) {
+        uint32_t level = (uint32_t)nes->ram[SMB_WORLD] * 4 + nes->ram[SMB_LEVEL];
+        return level << 16 | (uint32_t)nes->ram[SMB_PAGE] << 8 | nes->ram[SMB_X];
+    }
+    uint32_t score = 0;
+    for (unsigned int i = 0; i < score_count; i++) {
+        score = score << 8 | nes->ram[score_addrs[i] & (NES_RAM_SIZE - 1)];
+    }
+    return score;
+}
+
+static void sift_up(uint32_t i) {
+    entry_t entry = heap[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (heap[parent].score >= entry.score) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = entry;
+}
+
+static void sift_down(uint32_t i) {
+    entry_t entry = heap[i];
+    for (;;) {
+        uint32_t child = i * 2 + 1;
+        if (child >= heap_count) {
+            break;
+        }
+        if (child + 1 < heap_count && heap[child + 1].score > heap[child].score) {
+            child++;
+        }
+        if (heap[child].score <= entry.score) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = entry;
+}
+
+/* Takes ownership of state. When the frontier is full the new state
+ * replaces a random leaf it beats; the minimum is always a leaf, so this
+ * keeps the frontier biased towards the best without a full scan. The
+ * state handed back, if any, is for the caller to free. */
+static nes_t *push(uint32_t score, uint32_t node, nes_t *state) {
+    if (heap_count < frontier_size) {
+        heap[heap_count] = (entry_t){ score, node, state };
+        sift_up(heap_count++);
+        return NULL;
+    }
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    uint32_t first_leaf = heap_count / 2;
+    uint32_t leaf = first_leaf + (uint32_t)(rng_state % (heap_count - first_leaf));
+    if (heap[leaf].score >= score) {
+        return state;
+    }
+    nes_t *dropped = heap[leaf].state;
+    heap[leaf] = (entry_t){ score, node, state };
+    sift_up(leaf);
+    return dropped;
+}
+
+static uint32_t add_trail(uint32_t parent, uint8_t input) {
+    uint32_t node = atomic_fetch_add(&trail_count, 1);
+    if (node >= trail_capacity) {
+        return NO_PARENT;
+    }
+    trail[node].parent = parent;
+    trail[node].input = input;
+    trail[node].depth = parent == NO_PARENT ? 0 : (uint16_t)(trail[parent].depth + 1);
+    return node;
+}
+
+/* Blocks until there is a state to expand. Returns false once the budget
+ * is spent or nothing is left anywhere. */
+static bool pop(entry_t *entry) {
+    pthread_mutex_lock(&lock);
+    while (!stopping && heap_count == 0 && busy > 0) {
+        pthread_cond_wait(&ready, &lock);
+    }
+    if (stopping || heap_count == 0 || expansions >= max_expansions) {
+        stopping = true;
+        pthread_cond_broadcast(&ready);
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    *entry = heap[0];
+    heap[0] = heap[--heap_count];
+    if (heap_count) {
+        sift_down(0);
+    }
+    expansions++;
+    busy++;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+static void expand(worker_t *worker, const entry_t *entry) {
+    nes_t *spare = NULL;
+    for (unsigned int i = 0; i < input_count; i++) {
+        nes_t *child = spare ? spare : &worker->scratch;
+        *child = *entry->state;
+        worker->input = inputs[i];
+        nes_set_input_provider(child, held_input, &worker->input);
+        for (unsigned int frame = 0; frame < hold; frame++) {
+            nes_cpu_run(child, NES_FRAME_CYCLES);
+        }
+        worker->children++;
+        if (score_count == 0 && smb_dead(child)) {
+            worker->deaths++;
+            continue;
+        }
+        if (!insert_seen(hash_state(child))) {
+            worker->duplicates++;
+            continue;
+        }
+        uint32_t node = add_trail(entry->node, inputs[i]);
+        if (node == NO_PARENT) {
+            continue;
+        }
+        uint32_t score = score_state(child);
+        bool leaf = trail[node].depth >= max_depth;
+        nes_t *owned = NULL;
+        if (!leaf) {
+            owned = spare ? spare : malloc(sizeof(nes_t));
+            if (!owned) {
+                leaf = true;
+            } else if (owned != child) {
+                *owned = *child;
+            }
+            spare = NULL;
+        }
+        pthread_mutex_lock(&lock);
+        if (score > best_score || best_node == NO_PARENT) {
+            best_score = score;
+            best_node = node;
+        }
+        if (!leaf) {
+            spare = push(score, node, owned);
+            pthread_cond_signal(&ready);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+    free(spare);
+}
+
+static void *work(void *arg) {
+    worker_t *worker = arg;
+    entry_t entry;
+    while (pop(&entry)) {
+        expand(worker, &entry);
+        free(entry.state);
+        worker->expanded++;
+        pthread_mutex_lock(&lock);
+        busy--;
+        pthread_cond_broadcast(&ready);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static bool parse_hex(const char *text, unsigned long max, unsigned long *value) {
+    char *end;
+    if (*text == '$') {
+        text++;
+    }
+    *value = strtoul(text, &end, 16);
+    return end != text && !*end && *value <= max;
+}
+
+static bool parse_inputs(char *list) {
+    input_count = 0;
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        unsigned long value;
+        if (input_count == MAX_INPUTS || !parse_hex(item, 0xFF, &value)) {
+            return false;
+        }
+        inputs[input_count++] = (uint8_t)value;
+    }
+    return input_count > 0;
+}
+
+/* Boots and replays the prefix movie, which is also copied to out. */
+static bool start(nes_t *nes, const char *movie_path, FILE *out) {
+    static uint8_t input;
+    nes_init(nes, rom);
+    nes_sched_reset(nes);
+    nes_ppu_reset(nes);
+    nes_cpu_reset(nes);
+    nes_apu_reset(nes);
+    nes_set_input_provider(nes, held_input, &input);
+    if (!movie_path) {
+        return true;
+    }
+    FILE *movie = fopen(movie_path, "rb");
+    if (!movie) {
+        return false;
+    }
+    int c;
+    while ((c = fgetc(movie)) != EOF) {
+        input = (uint8_t)c;
+        nes_cpu_run(nes, NES_FRAME_CYCLES);
+        fputc(c, out);
+    }
+    fclose(movie);
+    return true;
+}
+
+static void write_route(uint32_t node, FILE *out) {
+    uint16_t depth = trail[node].depth;
+    uint8_t *route = malloc((size_t)depth + 1);
+    for (uint32_t n = node; n != NO_PARENT; n = trail[n].parent) {
+        route[trail[n].depth] = trail[n].input;
+    }
+    for (uint32_t i = 1; i <= depth; i++) {
+        for (unsigned int frame = 0; frame < hold; frame++) {
+            fputc(route[i], out);
+        }
+    }
+    free(route);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: search rom.nes [-m movie] [-o route] [-j threads] [-n expansions] [-k hold]\n"
+                    "              [-d depth] [-f frontier] [-i inputs] [-s addr]...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *movie_path = NULL;
+    const char *out_path = "route.mov";
+    unsigned long threads = 4;
+    if (argc < 2) {
+        usage();
+    }
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        char *value = i + 1 < argc ? argv[++i] : "";
+        unsigned long number;
+        char *end;
+        number = strtoul(value, &end, 10);
+        bool numeric = end != value && !*end && number > 0;
+        bool ok = true;
+        if (!strcmp(arg, "-m")) {
+            movie_path = value;
+        } else if (!strcmp(arg, "-o")) {
+            out_path = value;
+        } else if (!strcmp(arg, "-j") && numeric && number <= MAX_THREADS) {
+            threads = number;
+        } else if (!strcmp(arg, "-n") && numeric) {
+            max_expansions = (uint32_t)number;
+        } else if (!strcmp(arg, "-k") && numeric) {
+            hold = (unsigned int)number;
+        } else if (!strcmp(arg, "-d") && numeric && number < UINT16_MAX) {
+            max_depth = (unsigned int)number;
+        } else if (!strcmp(arg, "-f") && numeric && number > 1) {
+            frontier_size = (uint32_t)number;
+        } else if (!strcmp(arg, "-i")) {
+            ok = parse_inputs(value);
+        } else if (!strcmp(arg, "-s") && score_count < MAX_SCORE_BYTES) {
+            ok = parse_hex(value, 0xFFFF, &number);
+            score_addrs[score_count++] = (uint16_t)number;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "search: bad option %s %s\n", arg, value);
+            usage();
+        }
+    }
+    const char *error;
+    rom = rom_map(argv[1], &error);
+    if (!rom) {
+        fprintf(stderr, "search: %s: %s\n", argv[1], error);
+        return 1;
+    }
+    FILE *out = fopen(out_path, "wb");
+    nes_t *root = malloc(sizeof(nes_t));
+    if (!out || !root) {
+        fprintf(stderr, "search: cannot write %s\n", out_path);
+        return 1;
+    }
+    if (!start(root, movie_path, out)) {
+        fprintf(stderr, "search: cannot read %s\n", movie_path);
+        return 1;
+    }
+    start_lives = root->ram[SMB_LIVES];
+
+    /* Every expansion adds at most input_count states. */
+    trail_capacity = max_expansions * input_count + 1;
+    uint64_t seen_size = 1;
+    while (seen_size < (uint64_t)trail_capacity * 2) {
+        seen_size <<= 1;
+    }
+    seen_mask = seen_size - 1;
+    trail = malloc(sizeof(trail_t) * trail_capacity);
+    seen = calloc(seen_size, sizeof(*seen));
+    heap = malloc(sizeof(entry_t) * frontier_size);
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    if (!trail || !seen || !heap || !workers) {
+        fprintf(stderr, "search: out of memory\n");
+        return 1;
+    }
+    best_node = add_trail(NO_PARENT, 0);
+    best_score = score_state(root);
+    insert_seen(hash_state(root));
+    push(best_score, best_node, root);
+
+    struct timespec begin;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    pthread_t ids[MAX_THREADS];
+    for (unsigned long i = 0; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, work, &workers[i])) {
+            fprintf(stderr, "search: cannot start worker thread\n");
+            return 1;
+        }
+    }
+    uint32_t children = 0;
+    uint32_t duplicates = 0;
+    uint32_t deaths = 0;
+    for (unsigned long i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        children += workers[i].children;
+        duplicates += workers[i].duplicates;
+        deaths += workers[i].deaths;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    write_route(best_node, out);
+    fclose(out);
+    for (uint32_t i = 0; i < heap_count; i++) {
+        free(heap[i].state);
+    }
+    fprintf(stderr, "search: %u expanded, %u states, %u duplicate, %u dead in %.2f s\n", expansions,
+            children, duplicates, deaths, seconds);
+    fprintf(stderr, "search: %.0f states/s, %.0f frames/s\n", children / seconds,
+            (double)children * hold / seconds);
+    fprintf(stderr, "search: best score %06X after %u inputs, written to %s\n", best_score,
+            trail[best_node].depth, out_path);
+    nes_rom_release(rom);
+    return 0;
+}
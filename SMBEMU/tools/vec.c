@@ -0,0 +1,217 @@
+/* Drives nes_vec the way a batch of training episodes would, checks every
+ * lane against an instance run on its own and times both. Runs on a PC:
+ *
+ *   cc -std=c99 -O2 -DNES_VEC -Ihost -I../src -o vec vec.c host/rom_map.c \
+ *      ../src/nes_vec.c ../src/nes_cpu.c ../src/nes_mem.c ../src/nes_ppu.c \
+ *      ../src/nes_sched.c ../src/nes_apu.c ../src/nes_palette.c ../src/nes_rom.c
+ *   ./vec smb.nes [options]
+ *
+ *   -n N           lanes (default 64)
+ *   -e N           episodes (default 4)
+ *   -l N           steps per episode (default 100)
+ *   -k N           frames per step (default 4)
+ *   -a N           percent of lanes that take the first lane's input each
+ *                  step rather than a random one (default 50)
+ *   -s N           random seed (default 1)
+ *
+ * Every episode resets all lanes to one state saved after booting, as a
+ * training loop does, so lanes start out shared and drift apart as their
+ * inputs differ. The same inputs are then replayed through one nes_t per
+ * lane with plain nes_cpu_run calls. The report gives both run times, the
+ * emulated and shared frame counts and the number of lanes whose RAM, PC,
+ * clock or final picture differ from their reference, which must be 0. The
+ * odd lanes are reset first and drawn before the even ones are, and must
+ * all show the boot picture even when they followed an even lane in the
+ * step before. The exit status is 1 if either count is not 0. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "nes.h"
+#include "nes_mem.h"
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "nes_sched.h"
+#include "nes_apu.h"
+#include "nes_rom.h"
+#include "nes_vec.h"
+#include "rom_map.h"
+
+#ifndef NES_VEC
+#error "build with -DNES_VEC"
+#endif
+
+#define BOOT_FRAMES 60
+
+static uint32_t rng_state;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint8_t read_input(void *ctx) {
+    return *(const uint8_t *)ctx;
+}
+
+static double elapsed(clock_t begin) {
+    return (double)(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.nes [-n lanes] [-e episodes] [-l steps] [-k frames] [-a percent] [-s seed]\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static nes_t boot;
+    static nes_ppu_frame_t frame;
+    uint32_t lanes = 64;
+    uint32_t episodes = 4;
+    uint32_t steps = 100;
+    uint32_t frames = 4;
+    uint32_t agree = 50;
+    rng_state = 1;
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || !argv[i][1] || !strchr("nelkas", argv[i][1]) || argv[i][2]) {
+            usage(argv[0]);
+        }
+        uint32_t value = (uint32_t)strtoul(argv[++i], NULL, 0);
+        switch (argv[i - 1][1]) {
+        case 'n': lanes = value; break;
+        case 'e': episodes = value; break;
+        case 'l': steps = value; break;
+        case 'k': frames = value; break;
+        case 'a': agree = value; break;
+        default: rng_state = value ? value : 1; break;
+        }
+    }
+    if (lanes == 0 || lanes >= 0xFFFF || frames == 0 || frames > 0xFFFF) {
+        usage(argv[0]);
+    }
+
+    const char *error;
+    nes_rom_t *rom = rom_map(argv[1], &error);
+    if (!rom) {
+        fprintf(stderr, "%s: %s\n", argv[1], error);
+        return 2;
+    }
+    nes_init(&boot, rom);
+    nes_sched_reset(&boot);
+    nes_ppu_reset(&boot);
+    nes_cpu_reset(&boot);
+    nes_apu_reset(&boot);
+    for (int i = 0; i < BOOT_FRAMES; i++) {
+        nes_cpu_run(&boot, NES_FRAME_CYCLES);
+    }
+
+    nes_t *instances = malloc(lanes * sizeof(nes_t));
+    nes_t *solo = malloc(lanes * sizeof(nes_t));
+    nes_vec_lane_t *lane_info = malloc(lanes * sizeof(nes_vec_lane_t));
+    uint8_t *inputs = malloc(lanes);
+    uint8_t *solo_inputs = malloc(lanes);
+    uint8_t *script = malloc((size_t)episodes * steps * lanes);
+    uint8_t *pictures = malloc((size_t)lanes * NES_VEC_FRAME_SIZE);
+    uint8_t *picture = malloc(NES_VEC_FRAME_SIZE);
+    if (!instances || !solo || !lane_info || !inputs || !solo_inputs || !script || !pictures || !picture) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    for (size_t i = 0; i < (size_t)episodes * steps; i++) {
+        uint8_t *row = script + i * lanes;
+        row[0] = (uint8_t)next_random();
+        for (uint32_t lane = 1; lane < lanes; lane++) {
+            row[lane] = next_random() % 100 < agree ? row[0] : (uint8_t)next_random();
+        }
+    }
+
+    /* A lane's picture right after it is reset, which must be the boot
+     * picture however the lanes were grouped before. */
+    memset(picture, 0, NES_VEC_FRAME_SIZE);
+    nes_ppu_capture(&boot, &frame);
+    nes_ppu_draw(&frame, boot.chr, picture);
+    uint32_t stale = 0;
+
+    nes_vec_t vec;
+    nes_vec_init(&vec, instances, lane_info, inputs, (uint16_t)lanes, rom);
+    clock_t begin = clock();
+    for (uint32_t episode = 0; episode < episodes; episode++) {
+        /* Odd lanes first, so some lanes that followed a lane still to be
+         * reset are drawn while it holds the last step's state. */
+        for (uint32_t lane = 1; lane < lanes; lane += 2) {
+            nes_vec_set(&vec, (uint16_t)lane, &boot);
+        }
+        nes_vec_draw(&vec, pictures);
+        for (uint32_t lane = 1; lane < lanes; lane += 2) {
+            stale += memcmp(pictures + (size_t)lane * NES_VEC_FRAME_SIZE, picture, NES_VEC_FRAME_SIZE) != 0;
+        }
+        for (uint32_t lane = 0; lane < lanes; lane += 2) {
+            nes_vec_set(&vec, (uint16_t)lane, &boot);
+        }
+        for (uint32_t step = 0; step < steps; step++) {
+            memcpy(inputs, script + ((size_t)episode * steps + step) * lanes, lanes);
+            nes_vec_step(&vec, (uint16_t)frames);
+        }
+    }
+    double vec_seconds = elapsed(begin);
+
+    begin = clock();
+    for (uint32_t episode = 0; episode < episodes; episode++) {
+        for (uint32_t lane = 0; lane < lanes; lane++) {
+            solo[lane] = boot;
+            nes_set_input_provider(&solo[lane], read_input, &solo_inputs[lane]);
+        }
+        for (uint32_t step = 0; step < steps; step++) {
+            memcpy(solo_inputs, script + ((size_t)episode * steps + step) * lanes, lanes);
+            for (uint32_t lane = 0; lane < lanes; lane++) {
+                for (uint32_t i = 0; i < frames; i++) {
+                    nes_cpu_run(&solo[lane], NES_FRAME_CYCLES);
+                }
+            }
+        }
+    }
+    double solo_seconds = elapsed(begin);
+
+    uint32_t mismatches = 0;
+    nes_vec_view_t ram = nes_vec_ram(&vec);
+    nes_vec_draw(&vec, pictures);
+    for (uint32_t lane = 0; lane < lanes; lane++) {
+        const nes_t *nes = &solo[lane];
+        memset(picture, 0, NES_VEC_FRAME_SIZE);
+        nes_ppu_capture(nes, &frame);
+        nes_ppu_draw(&frame, nes->chr, picture);
+        if (memcmp(ram.base + lane * ram.stride, nes->ram, ram.size) != 0 ||
+            instances[lane].cpu.pc != nes->cpu.pc || instances[lane].sched.now != nes->sched.now ||
+            memcmp(pictures + (size_t)lane * NES_VEC_FRAME_SIZE, picture, NES_VEC_FRAME_SIZE) != 0) {
+            mismatches++;
+        }
+    }
+
+    uint32_t total = vec.frames_run + vec.frames_shared;
+    printf("%lu lanes, %lu frames: vec %.3fs, separate %.3fs (%.2fx)\n", (unsigned long)lanes,
+           (unsigned long)total, vec_seconds, solo_seconds, vec_seconds > 0 ? solo_seconds / vec_seconds : 0.0);
+    printf("emulated %lu, shared %lu (%.1f%%), mismatched lanes %lu\n", (unsigned long)vec.frames_run,
+           (unsigned long)vec.frames_shared, total ? 100.0 * vec.frames_shared / total : 0.0,
+           (unsigned long)mismatches);
+    printf("lanes drawn wrong after a reset %lu\n", (unsigned long)stale);
+    nes_vec_close(&vec);
+    nes_rom_release(rom);
+    free(instances);
+    free(solo);
+    free(lane_info);
+    free(inputs);
+    free(solo_inputs);
+    free(script);
+    free(pictures);
+    free(picture);
+    return mismatches || stale ? 1 : 0;
+}